@@ -1,7 +1,41 @@
 #ifndef YT_COMMON_H
 #define YT_COMMON_H
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
+#include <wayland-util.h>
 #define __UNUSED__ __attribute__ ((unused))
 struct yt_seat_notify_interface *yt_seat_notify_get(struct yt_seat *seat, void **data);
+
+/* Ready sources are drained by yt_seat_dispatch() in this order. */
+enum yt_source_priority {
+	YT_SOURCE_SIGNAL,
+	YT_SOURCE_QUEUE,
+	YT_SOURCE_DEVICE,
+	YT_SOURCE_TIMER,
+	YT_SOURCE_HOTPLUG,
+	YT_SOURCE_TTY,
+	YT_SOURCE_PRIORITY_COUNT
+};
+
+typedef int (*yt_source_func_t)(int fd, uint32_t mask, void *data);
+
+struct yt_source {
+	int fd;
+	/* The seat's epoll set, or the input thread's one */
+	int epoll_fd;
+	enum yt_source_priority priority;
+	yt_source_func_t func;
+	void *data;
+	struct wl_list link;
+};
+
+struct yt_source *yt_seat_source_add(struct yt_seat *seat, int fd,
+		enum yt_source_priority priority, yt_source_func_t func, void *data);
+void yt_seat_source_remove(struct yt_seat *seat, struct yt_source *source);
+struct yt_thread *yt_seat_thread_get(struct yt_seat *seat);
+struct yt_timer_wheel *yt_seat_timers_get(struct yt_seat *seat);
+struct evdev_key_repeat *yt_seat_key_repeat_get(struct yt_seat *seat);
+struct yt_xkb *yt_seat_xkb_get(struct yt_seat *seat);
+struct yt_modifiers *yt_seat_modifiers(struct yt_seat *seat);
 #endif // YT_COMMON_H
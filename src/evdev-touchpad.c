@@ -22,26 +22,26 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
 #include <string.h>
 #include <stdbool.h>
 #include <linux/input.h>
-#include <sys/timerfd.h>
+#include <time.h>
 
-//#include "filter.h"
 #include "evdev.h"
 #include "yutani.h"
 #include "common.h"
+#include "trace.h"
 
 /* Default values */
-/*#define DEFAULT_CONSTANT_ACCEL_NUMERATOR 50
-#define DEFAULT_MIN_ACCEL_FACTOR 0.16
-#define DEFAULT_MAX_ACCEL_FACTOR 1.0*/
-#define DEFAULT_HYSTERESIS_MARGIN_DENOMINATOR 700.0
+#define DEFAULT_HYSTERESIS_MARGIN_DENOMINATOR 700
 
 #define DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON BTN_LEFT
 #define DEFAULT_TOUCHPAD_SINGLE_TAP_TIMEOUT 100
 
+/* FSM events queued between two runs of the state machine. A frame
+ * queues at most three, so running out means something is badly off. */
+#define FSM_EVENT_QUEUE_SIZE 8
+
 enum touchpad_model {
 	TOUCHPAD_MODEL_UNKNOWN = 0,
 	TOUCHPAD_MODEL_SYNAPTICS,
@@ -50,14 +50,6 @@ enum touchpad_model {
 	TOUCHPAD_MODEL_ELANTECH
 };
 
-enum touchpad_event {
-	TOUCHPAD_EVENT_NONE = 0,
-	TOUCHPAD_EVENT_ABSOLUTE_ANY = (1 << 0),
-	TOUCHPAD_EVENT_ABSOLUTE_X = (1 << 1),
-	TOUCHPAD_EVENT_ABSOLUTE_Y = (1 << 2),
-	TOUCHPAD_EVENT_REPORT = (1 << 3)
-};
-
 struct touchpad_model_spec {
 	short vendor;
 	short product;
@@ -78,7 +70,12 @@ enum touchpad_state {
 	TOUCHPAD_STATE_MOVE = (1 << 1)
 };
 
-#define TOUCHPAD_HISTORY_LENGTH 4
+/* Positions kept for the delta estimate. The ring is a power of two so
+ * it is indexed with a mask; the length in use is any even number up to
+ * its size. */
+#define TOUCHPAD_HISTORY_SIZE 16
+#define TOUCHPAD_HISTORY_MASK (TOUCHPAD_HISTORY_SIZE - 1)
+#define DEFAULT_TOUCHPAD_HISTORY_LENGTH 4
 
 struct touchpad_motion {
 	int32_t x;
@@ -115,22 +112,15 @@ struct touchpad_dispatch {
 	int finger_state;
 	int last_finger_state;
 
-/*	double constant_accel_factor;
-	double min_accel_factor;
-	double max_accel_factor;*/
-
-	unsigned int event_mask;
-/*	unsigned int event_mask_filter;*/
-
 	int reset;
 
 	struct {
 		bool enable;
 
-		struct wl_array events;
+		uint8_t events[FSM_EVENT_QUEUE_SIZE];
+		unsigned int count;
+		bool overflow;
 		enum fsm_state state;
-		int timer_fd;
-//		struct wl_event_source *timer_source;
 	} fsm;
 
 	struct {
@@ -151,25 +141,27 @@ struct touchpad_dispatch {
 		int32_t center_y;
 	} hysteresis;
 
-	struct touchpad_motion motion_history[TOUCHPAD_HISTORY_LENGTH];
-	int motion_index;
+	struct touchpad_motion motion_history[TOUCHPAD_HISTORY_SIZE];
+	unsigned int motion_index;
 	unsigned int motion_count;
+	unsigned int history_length;
 
-//	struct weston_motion_filter *filter;
+	/* Exponential smoothing of the deltas, weight of the newest one
+	 * in 1/256; 256 turns it off */
+	int32_t smoothing;
+	wl_fixed_t smooth_dx;
+	wl_fixed_t smooth_dy;
 };
 
 static enum touchpad_model get_touchpad_model(struct evdev_device *device)
 {
-	struct input_id id;
+	struct input_id *id = &device->caps.id;
 	unsigned int i;
 
-	if (ioctl(device->base.fd, EVIOCGID, &id) < 0)
-		return TOUCHPAD_MODEL_UNKNOWN;
-
 	for (i = 0; i < ARRAY_LENGTH(touchpad_spec_table); i++)
-		if (touchpad_spec_table[i].vendor == id.vendor &&
+		if (touchpad_spec_table[i].vendor == id->vendor &&
 				(!touchpad_spec_table[i].product ||
-				 touchpad_spec_table[i].product == id.product))
+				 touchpad_spec_table[i].product == id->product))
 			return touchpad_spec_table[i].model;
 
 	return TOUCHPAD_MODEL_UNKNOWN;
@@ -190,44 +182,17 @@ static void configure_touchpad_pressure(struct touchpad_dispatch *touchpad,
 			break;
 		default:
 			touchpad->pressure.touch_low =
-				pressure_min + range * (25.0 / 256.0);
+				pressure_min + range * 25 / 256;
 			touchpad->pressure.touch_high =
-				pressure_min + range * (30.0 / 256.0);
+				pressure_min + range * 30 / 256;
 	}
 }
 
-/*static double touchpad_profile(struct weston_motion_filter *filter,
-		void *data, double velocity, uint32_t time)
-{
-	struct touchpad_dispatch *touchpad = (struct touchpad_dispatch *)data;
-
-	double accel_factor;
-
-	accel_factor = velocity * touchpad->constant_accel_factor;
-
-	if (accel_factor > touchpad->max_accel_factor)
-		accel_factor = touchpad->max_accel_factor;
-	else if (accel_factor < touchpad->min_accel_factor)
-		accel_factor = touchpad->min_accel_factor;
-
-	return accel_factor;
-}*/
-
-static inline struct touchpad_motion *motion_history_offset(struct
-		touchpad_dispatch
-		*touchpad,
-		int offset)
-{
-	int offset_index =
-		(touchpad->motion_index - offset + TOUCHPAD_HISTORY_LENGTH) %
-		TOUCHPAD_HISTORY_LENGTH;
-
-	return &touchpad->motion_history[offset_index];
-}
-
-static double estimate_delta(int x0, int x1, int x2, int x3)
+static inline struct touchpad_motion *motion_history_offset(
+		struct touchpad_dispatch *touchpad, unsigned int offset)
 {
-	return (x0 + x1 - x2 - x3) / 4;
+	return &touchpad->motion_history[(touchpad->motion_index - offset) &
+		TOUCHPAD_HISTORY_MASK];
 }
 
 static int hysteresis(int in, int center, int margin)
@@ -243,84 +208,101 @@ static int hysteresis(int in, int center, int margin)
 	return center + diff;
 }
 
-static void touchpad_get_delta(struct touchpad_dispatch *touchpad, double *dx, double *dy)
+/* The mean position of the newer half of the history minus that of the
+ * older half, over the half length in frames between them: a motion
+ * per frame in 24.8 fixed point. Integer only, so every build and every
+ * replay of a recording produces the same deltas. */
+static void touchpad_get_delta(struct touchpad_dispatch *touchpad,
+		wl_fixed_t *dx, wl_fixed_t *dy)
 {
-	*dx = estimate_delta(motion_history_offset(touchpad, 0)->x,
-			motion_history_offset(touchpad, 1)->x,
-			motion_history_offset(touchpad, 2)->x,
-			motion_history_offset(touchpad, 3)->x);
-	*dy = estimate_delta(motion_history_offset(touchpad, 0)->y,
-			motion_history_offset(touchpad, 1)->y,
-			motion_history_offset(touchpad, 2)->y,
-			motion_history_offset(touchpad, 3)->y);
+	unsigned int half = touchpad->history_length / 2, i;
+	struct touchpad_motion *m;
+	int64_t sx = 0, sy = 0;
+
+	for (i = 0; i < touchpad->history_length; i++) {
+		m = motion_history_offset(touchpad, i);
+		if (i < half) {
+			sx += m->x;
+			sy += m->y;
+		} else {
+			sx -= m->x;
+			sy -= m->y;
+		}
+	}
+
+	*dx = sx * 256 / (int64_t)(half * half);
+	*dy = sy * 256 / (int64_t)(half * half);
 }
 
-/*static void filter_motion(struct touchpad_dispatch *touchpad,
-		double *dx, double *dy, uint32_t time)
+static inline wl_fixed_t smooth(wl_fixed_t prev, wl_fixed_t delta,
+		int32_t weight)
 {
-	struct weston_motion_params motion;
-
-	motion.dx = *dx;
-	motion.dy = *dy;
+	return prev + (int64_t)(delta - prev) * weight / 256;
+}
 
-	weston_filter_dispatch(touchpad->filter, &motion, touchpad, time);
+/* Smoothing starts over with every motion */
+static void touchpad_smooth_delta(struct touchpad_dispatch *touchpad,
+		wl_fixed_t *dx, wl_fixed_t *dy)
+{
+	if (touchpad->smoothing >= 256)
+		return;
 
-	*dx = motion.dx;
-	*dy = motion.dy;
-}*/
+	if (touchpad->motion_count > touchpad->history_length) {
+		*dx = smooth(touchpad->smooth_dx, *dx, touchpad->smoothing);
+		*dy = smooth(touchpad->smooth_dy, *dy, touchpad->smoothing);
+	}
+	touchpad->smooth_dx = *dx;
+	touchpad->smooth_dy = *dy;
+}
 
-static void notify_button_pressed(struct touchpad_dispatch *touchpad, uint32_t time)
+static void notify_button_pressed(struct touchpad_dispatch *touchpad, uint64_t time)
 {
-	void *data;
-	struct yt_seat_notify_interface *notify = yt_seat_notify_get(touchpad->device->seat, &data);
-	
-	if (notify && notify->notify_button) {
-		notify->notify_button((struct yt_device *)touchpad->device,
-				data, time,
-				DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
-				WL_POINTER_BUTTON_STATE_PRESSED);
-	}
-/*	notify_button(touchpad->device->seat, time,
+	evdev_notify_button(touchpad->device, time,
 			DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
-			WL_POINTER_BUTTON_STATE_PRESSED);*/
+			YT_BUTTON_STATE_PRESSED);
 }
 
-static void notify_button_released(struct touchpad_dispatch *touchpad, uint32_t time)
+static void notify_button_released(struct touchpad_dispatch *touchpad, uint64_t time)
 {
-	void *data;
-	struct yt_seat_notify_interface *notify = yt_seat_notify_get(touchpad->device->seat, &data);
-	
-	if (notify && notify->notify_button) {
-		notify->notify_button((struct yt_device *)touchpad->device,
-				data, time,
-				DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
-				WL_POINTER_BUTTON_STATE_PRESSED);
-	}
-/*	notify_button(touchpad->device->seat, time,
+	evdev_notify_button(touchpad->device, time,
 			DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
-			WL_POINTER_BUTTON_STATE_RELEASED);*/
+			YT_BUTTON_STATE_RELEASED);
 }
 
-static void notify_tap(struct touchpad_dispatch *touchpad, uint32_t time)
+static void notify_tap(struct touchpad_dispatch *touchpad, uint64_t time)
 {
 	notify_button_pressed(touchpad, time);
 	notify_button_released(touchpad, time);
 }
 
-static void process_fsm_events(struct touchpad_dispatch *touchpad, uint32_t time)
+static void process_fsm_events(struct touchpad_dispatch *touchpad, uint64_t time)
 {
 	uint32_t timeout = UINT32_MAX;
-	enum fsm_event *pevent;
 	enum fsm_event event;
+	enum fsm_state state;
+	unsigned int i;
 
 	if (!touchpad->fsm.enable)
 		return;
 
-	if (touchpad->fsm.events.size == 0)
+	/* Events were lost, so whatever gesture was going on is unknown:
+	 * start over, without leaving a tap-and-drag button held. */
+	if (touchpad->fsm.overflow) {
+		if (touchpad->fsm.state == FSM_TAP_2 ||
+				touchpad->fsm.state == FSM_DRAG)
+			notify_button_released(touchpad, time);
+		touchpad->fsm.state = FSM_IDLE;
+		touchpad->fsm.overflow = false;
+		touchpad->fsm.count = 0;
+		return;
+	}
+
+	if (touchpad->fsm.count == 0)
 		return;
 
-	wl_array_for_each(pevent, &touchpad->fsm.events) {
-		event = *pevent;
+	for (i = 0; i < touchpad->fsm.count; i++) {
+		event = touchpad->fsm.events[i];
+		state = touchpad->fsm.state;
 		timeout = 0;
 
 		switch (touchpad->fsm.state) {
@@ -391,92 +373,70 @@ static void process_fsm_events(struct touchpad_dispatch *touchpad, uint32_t time
 				touchpad->fsm.state = FSM_IDLE;
 				break;
 		}
-	}
 
-	if (timeout != UINT32_MAX) {
-		struct itimerspec its;
-		its.it_interval.tv_sec = 0;
-		its.it_interval.tv_nsec = 0;
-		its.it_value.tv_sec = timeout / 1000;
-		its.it_value.tv_nsec = (timeout % 1000) * 1000 * 1000;
-		if (timerfd_settime(touchpad->fsm.timer_fd, 0, &its, NULL) < 0)
-			fprintf(stderr, "could not set timerfd\n: %m");
-
-		/*wl_event_source_timer_update(touchpad->fsm.timer_source,
-				timeout);*/
+		YT_TRACE3(fsm, state, event, touchpad->fsm.state);
 	}
 
-	wl_array_release(&touchpad->fsm.events);
-	wl_array_init(&touchpad->fsm.events);
+	/* Any transition but the one into FSM_TAP drops the pending timeout.
+	 * It is counted on the clock of the wheel, which for a replay is the
+	 * recorded time rather than now. */
+	if (timeout == 0)
+		yt_timer_cancel(&touchpad->device->timer);
+	else if (timeout != UINT32_MAX && touchpad->device->timers)
+		yt_timer_arm(touchpad->device->timers, &touchpad->device->timer,
+				yt_timer_wheel_now(touchpad->device->timers) +
+				timeout * 1000000ULL);
+
+	touchpad->fsm.count = 0;
 }
 
 static void push_fsm_event(struct touchpad_dispatch *touchpad, enum fsm_event event)
 {
-	enum fsm_event *pevent;
-
 	if (!touchpad->fsm.enable)
 		return;
 
-	pevent = wl_array_add(&touchpad->fsm.events, sizeof event);
-	if (pevent)
-		*pevent = event;
-	else
-		touchpad->fsm.state = FSM_IDLE;
+	if (touchpad->fsm.count == FSM_EVENT_QUEUE_SIZE) {
+		touchpad->fsm.overflow = true;
+		return;
+	}
+
+	touchpad->fsm.events[touchpad->fsm.count++] = event;
 }
 
-static int fsm_timout_handler(void *data)
+static void fsm_timeout_handler(struct yt_timer *timer, uint64_t now)
 {
-	struct touchpad_dispatch *touchpad = data;
+	struct evdev_device *device = timer->data;
+	struct touchpad_dispatch *touchpad =
+		(struct touchpad_dispatch *)device->dispatch;
 
-	if (touchpad->fsm.events.size == 0) {
+	if (touchpad->fsm.count == 0) {
 		push_fsm_event(touchpad, FSM_EVENT_TIMEOUT);
-		struct timeval tv;
-		gettimeofday(&tv, NULL);
-		process_fsm_events(touchpad, tv.tv_sec * 1000 + tv.tv_usec / 1000);
-//		process_fsm_events(touchpad, weston_compositor_get_time());
+		process_fsm_events(touchpad, now);
 	}
 
-	return 1;
-}
-
-int touchpad_timeout_handler(struct evdev_device *device)
-{
-	return fsm_timout_handler(device->dispatch);
+	/* Taps fired from the timeout are not part of any SYN_REPORT. */
+	evdev_notify_frame(device);
 }
 
-static void touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
+static void touchpad_update_state(struct touchpad_dispatch *touchpad, uint64_t time)
 {
-	int motion_index;
 	int center_x, center_y;
-	double dx = 0.0, dy = 0.0;
+	wl_fixed_t dx = 0, dy = 0;
 
+	/* A release, a tool change or a different number of fingers
+	 * during the frame starts a new motion, and this frame's position
+	 * is its first sample. */
 	if (touchpad->reset ||
 			touchpad->last_finger_state != touchpad->finger_state) {
 		touchpad->reset = 0;
 		touchpad->motion_count = 0;
-		touchpad->event_mask = TOUCHPAD_EVENT_NONE;
-/*		touchpad->event_mask_filter =
-			TOUCHPAD_EVENT_ABSOLUTE_X | TOUCHPAD_EVENT_ABSOLUTE_Y;*/
-
 		touchpad->last_finger_state = touchpad->finger_state;
-
-		process_fsm_events(touchpad, time);
-
-		return;
 	}
-	touchpad->last_finger_state = touchpad->finger_state;
-
-	if (!(touchpad->event_mask & TOUCHPAD_EVENT_REPORT))
-		return;
-	else
-		touchpad->event_mask &= ~TOUCHPAD_EVENT_REPORT;
-
-/*	if ((touchpad->event_mask & touchpad->event_mask_filter) !=
-			touchpad->event_mask_filter)
-		return;*/
 
-//	touchpad->event_mask_filter = TOUCHPAD_EVENT_ABSOLUTE_ANY;
-	touchpad->event_mask = 0;
+	/* Only one finger moves the pointer */
+	if (touchpad->state & TOUCHPAD_STATE_TOUCH &&
+			touchpad->finger_state == TOUCHPAD_FINGERS_ONE)
+		touchpad->device->motion_samples++;
 
 	/* Avoid noice by moving center only when delta reaches a threshold
 	 * distance from the old center. */
@@ -497,44 +457,35 @@ static void touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t t
 	touchpad->hw_abs.y = center_y;
 
 	/* Update motion history tracker */
-	motion_index = (touchpad->motion_index + 1) % TOUCHPAD_HISTORY_LENGTH;
-	touchpad->motion_index = motion_index;
-	touchpad->motion_history[motion_index].x = touchpad->hw_abs.x;
-	touchpad->motion_history[motion_index].y = touchpad->hw_abs.y;
-	if (touchpad->motion_count < 4)
+	touchpad->motion_index = (touchpad->motion_index + 1) & TOUCHPAD_HISTORY_MASK;
+	touchpad->motion_history[touchpad->motion_index].x = touchpad->hw_abs.x;
+	touchpad->motion_history[touchpad->motion_index].y = touchpad->hw_abs.y;
+	/* Counts one past the history, to tell the first delta apart */
+	if (touchpad->motion_count <= touchpad->history_length)
 		touchpad->motion_count++;
 
-	if (touchpad->motion_count >= 4) {
+	if (touchpad->motion_count >= touchpad->history_length) {
 		touchpad_get_delta(touchpad, &dx, &dy);
-
-//		filter_motion(touchpad, &dx, &dy, time);
+		touchpad_smooth_delta(touchpad, &dx, &dy);
 
 		if (touchpad->finger_state == TOUCHPAD_FINGERS_ONE) {
-			touchpad->device->rel.dx = wl_fixed_from_double(dx);
-			touchpad->device->rel.dy = wl_fixed_from_double(dy);
+			touchpad->device->rel.dx = dx;
+			touchpad->device->rel.dy = dy;
 			touchpad->device->pending_events |=
-				EVDEV_RELATIVE_MOTION | EVDEV_SYN;
+				EVDEV_RELATIVE_MOTION;
 		} else if (touchpad->finger_state == TOUCHPAD_FINGERS_TWO) {
-			void *data;
-			struct yt_seat_notify_interface *notify = yt_seat_notify_get(touchpad->device->seat, &data);
-			if (notify && notify->notify_axis) {
-				if (dx != 0.0) {
-					notify->notify_axis((struct yt_device *)touchpad->device,
-							data, time,
-							WL_POINTER_AXIS_HORIZONTAL_SCROLL,
-							wl_fixed_from_double(dx));
-				}
-				if (dy != 0.0) {
-					notify->notify_axis((struct yt_device *)touchpad->device,
-							data, time,
-							WL_POINTER_AXIS_VERTICAL_SCROLL,
-							wl_fixed_from_double(dy));
-				}
-			}
+			if (dx != 0)
+				evdev_notify_axis(touchpad->device, time,
+						YT_AXIS_TYPE_HORIZONTAL_SCROLL, dx);
+			if (dy != 0)
+				evdev_notify_axis(touchpad->device, time,
+						YT_AXIS_TYPE_VERTICAL_SCROLL, dy);
 		}
 	}
 
-	if (!(touchpad->state & TOUCHPAD_STATE_MOVE) && ((int)dx || (int)dy)) {
+	/* At least a whole unit of motion, either way */
+	if (!(touchpad->state & TOUCHPAD_STATE_MOVE) &&
+			(abs(dx) >= 256 || abs(dy) >= 256)) {
 		touchpad->state |= TOUCHPAD_STATE_MOVE;
 		push_fsm_event(touchpad, FSM_EVENT_MOTION);
 	}
@@ -558,7 +509,7 @@ static void on_release(struct touchpad_dispatch *touchpad)
 }
 
 static inline void process_absolute(struct touchpad_dispatch *touchpad,
-		struct evdev_device *device __UNUSED__, struct input_event *e)
+		struct evdev_device *device, struct input_event *e)
 {
 	switch (e->code) {
 		case ABS_PRESSURE:
@@ -571,27 +522,22 @@ static inline void process_absolute(struct touchpad_dispatch *touchpad,
 
 			break;
 		case ABS_X:
-			if (touchpad->state & TOUCHPAD_STATE_TOUCH) {
+			if (touchpad->state & TOUCHPAD_STATE_TOUCH)
 				touchpad->hw_abs.x = e->value;
-				touchpad->event_mask |= TOUCHPAD_EVENT_ABSOLUTE_ANY;
-				touchpad->event_mask |= TOUCHPAD_EVENT_ABSOLUTE_X;
-			}
 			break;
 		case ABS_Y:
-			if (touchpad->state & TOUCHPAD_STATE_TOUCH) {
+			if (touchpad->state & TOUCHPAD_STATE_TOUCH)
 				touchpad->hw_abs.y = e->value;
-				touchpad->event_mask |= TOUCHPAD_EVENT_ABSOLUTE_ANY;
-				touchpad->event_mask |= TOUCHPAD_EVENT_ABSOLUTE_Y;
-			}
+			break;
+		default:
+			device->stats.events_dropped++;
 			break;
 	}
 }
 
 static inline void process_key(struct touchpad_dispatch *touchpad,
-		struct evdev_device *device __UNUSED__, struct input_event *e, uint32_t time)
+		struct evdev_device *device, struct input_event *e, uint64_t time)
 {
-	void *data;
-	struct yt_seat_notify_interface *notify = yt_seat_notify_get(touchpad->device->seat, &data);
 	switch (e->code) {
 		case BTN_TOUCH:
 			if (!touchpad->has_pressure) {
@@ -610,12 +556,9 @@ static inline void process_key(struct touchpad_dispatch *touchpad,
 		case BTN_FORWARD:
 		case BTN_BACK:
 		case BTN_TASK:
-			if (notify && notify->notify_button) {
-				notify->notify_button((struct yt_device *)touchpad->device,
-						data, time, e->code,
-						e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
-						WL_POINTER_BUTTON_STATE_RELEASED);
-			}
+			evdev_notify_button(touchpad->device, time, e->code,
+					e->value ? YT_BUTTON_STATE_PRESSED :
+					YT_BUTTON_STATE_RELEASED);
 			break;
 		case BTN_TOOL_PEN:
 		case BTN_TOOL_RUBBER:
@@ -644,12 +587,17 @@ static inline void process_key(struct touchpad_dispatch *touchpad,
 			else
 				touchpad->finger_state &= ~TOUCHPAD_FINGERS_THREE;
 			break;
+		default:
+			device->stats.events_dropped++;
+			break;
 	}
 }
 
+/* Events only update the touchpad state; motion, scrolling and the
+ * FSM run once per frame, at its SYN_REPORT. */
 static void touchpad_process(struct evdev_dispatch *dispatch,
 		struct evdev_device *device,
-		struct input_event *e, uint32_t time)
+		struct input_event *e, uint64_t time)
 {
 	struct touchpad_dispatch *touchpad =
 		(struct touchpad_dispatch *)dispatch;
@@ -657,7 +605,9 @@ static void touchpad_process(struct evdev_dispatch *dispatch,
 	switch (e->type) {
 		case EV_SYN:
 			if (e->code == SYN_REPORT)
-				touchpad->event_mask |= TOUCHPAD_EVENT_REPORT;
+				touchpad_update_state(touchpad, time);
+			else
+				device->stats.events_dropped++;
 			break;
 		case EV_ABS:
 			process_absolute(touchpad, device, e);
@@ -665,9 +615,10 @@ static void touchpad_process(struct evdev_dispatch *dispatch,
 		case EV_KEY:
 			process_key(touchpad, device, e, time);
 			break;
+		default:
+			device->stats.events_dropped++;
+			break;
 	}
-
-	touchpad_update_state(touchpad, time);
 }
 
 static void touchpad_destroy(struct evdev_dispatch *dispatch)
@@ -675,31 +626,69 @@ static void touchpad_destroy(struct evdev_dispatch *dispatch)
 	struct touchpad_dispatch *touchpad =
 		(struct touchpad_dispatch *)dispatch;
 
-//	touchpad->filter->interface->destroy(touchpad->filter);
-//	wl_event_source_remove(touchpad->fsm.timer_source);
-	close(touchpad->fsm.timer_fd);
+	yt_timer_cancel(&touchpad->device->timer);
 	free(dispatch);
 }
 
+static void touchpad_event_mask(struct evdev_dispatch *dispatch,
+		struct evdev_device *device __UNUSED__,
+		struct evdev_event_mask *mask)
+{
+	struct touchpad_dispatch *touchpad =
+		(struct touchpad_dispatch *)dispatch;
+	unsigned int code;
+
+	SET_BIT(mask->key, BTN_TOUCH);
+	for (code = BTN_LEFT; code <= BTN_TASK; code++)
+		SET_BIT(mask->key, code);
+	for (code = BTN_TOOL_PEN; code <= BTN_TOOL_LENS; code++)
+		SET_BIT(mask->key, code);
+	SET_BIT(mask->key, BTN_TOOL_FINGER);
+	SET_BIT(mask->key, BTN_TOOL_DOUBLETAP);
+	SET_BIT(mask->key, BTN_TOOL_TRIPLETAP);
+
+	SET_BIT(mask->abs, ABS_X);
+	SET_BIT(mask->abs, ABS_Y);
+	if (touchpad->has_pressure)
+		SET_BIT(mask->abs, ABS_PRESSURE);
+}
+
 struct evdev_dispatch_interface touchpad_interface = {
 	touchpad_process,
-	touchpad_destroy
+	touchpad_destroy,
+	touchpad_event_mask
 };
 
+/* Floor of the square root */
+static uint32_t isqrt(uint64_t v)
+{
+	uint64_t root = 0, bit = 1ULL << 62;
+
+	while (bit > v)
+		bit >>= 2;
+	while (bit) {
+		if (v >= root + bit) {
+			v -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return root;
+}
+
 static int touchpad_init(struct touchpad_dispatch *touchpad, struct evdev_device *device)
 {
-//	struct weston_motion_filter *accel;
 //	struct wl_event_loop *loop;
 
-	unsigned long prop_bits[INPUT_PROP_MAX];
-	struct input_absinfo absinfo;
-	unsigned long abs_bits[NBITS(ABS_MAX)];
-
+	struct evdev_caps *caps = &device->caps;
 	bool has_buttonpad;
 
-	double width;
-	double height;
-	double diagonal;
+	uint64_t width;
+	uint64_t height;
+	uint32_t diagonal;
 
 	touchpad->base.interface = &touchpad_interface;
 	touchpad->device = device;
@@ -707,27 +696,20 @@ static int touchpad_init(struct touchpad_dispatch *touchpad, struct evdev_device
 	/* Detect model */
 	touchpad->model = get_touchpad_model(device);
 
-	ioctl(device->base.fd, EVIOCGPROP(sizeof(prop_bits)), prop_bits);
-	has_buttonpad = TEST_BIT(prop_bits, INPUT_PROP_BUTTONPAD);
+	has_buttonpad = TEST_BIT(caps->props, INPUT_PROP_BUTTONPAD);
 
 	/* Configure pressure */
-	ioctl(device->base.fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits);
-	if (TEST_BIT(abs_bits, ABS_PRESSURE)) {
-		ioctl(device->base.fd, EVIOCGABS(ABS_PRESSURE), &absinfo);
+	if (TEST_BIT(caps->abs, ABS_PRESSURE))
 		configure_touchpad_pressure(touchpad,
-				absinfo.minimum, absinfo.maximum);
-	}
+				caps->absinfo[ABS_PRESSURE].minimum,
+				caps->absinfo[ABS_PRESSURE].maximum);
 
-	/* Configure acceleration factor */
+	/* Acceleration is applied when the device flushes the motion; it
+	 * only needs the size to scale velocities by. */
 	width = abs(device->abs.max_x - device->abs.min_x);
 	height = abs(device->abs.max_y - device->abs.min_y);
-	diagonal = sqrt(width * width + height * height);
-
-/*	touchpad->constant_accel_factor =
-		DEFAULT_CONSTANT_ACCEL_NUMERATOR / diagonal;
-
-	touchpad->min_accel_factor = DEFAULT_MIN_ACCEL_FACTOR;
-	touchpad->max_accel_factor = DEFAULT_MAX_ACCEL_FACTOR;*/
+	diagonal = isqrt(width * width + height * height);
+	device->accel_diagonal = diagonal;
 
 	touchpad->hysteresis.margin_x =
 		diagonal / DEFAULT_HYSTERESIS_MARGIN_DENOMINATOR;
@@ -736,38 +718,24 @@ static int touchpad_init(struct touchpad_dispatch *touchpad, struct evdev_device
 	touchpad->hysteresis.center_x = 0;
 	touchpad->hysteresis.center_y = 0;
 
-	/* Configure acceleration profile */
-/*	accel = create_pointer_accelator_filter(touchpad_profile);
-	if (accel == NULL)
-		return -1;
-	touchpad->filter = accel;*/
-
 	/* Setup initial state */
 	touchpad->reset = 1;
 
 	memset(touchpad->motion_history, 0, sizeof touchpad->motion_history);
 	touchpad->motion_index = 0;
 	touchpad->motion_count = 0;
+	touchpad->history_length = DEFAULT_TOUCHPAD_HISTORY_LENGTH;
+	touchpad->smoothing = 256;
 
 	touchpad->state = TOUCHPAD_STATE_NONE;
 	touchpad->last_finger_state = 0;
 	touchpad->finger_state = 0;
 
-	wl_array_init(&touchpad->fsm.events);
+	touchpad->fsm.count = 0;
+	touchpad->fsm.overflow = false;
 	touchpad->fsm.state = FSM_IDLE;
 
-	touchpad->fsm.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-	if (touchpad->fsm.timer_fd < 0)
-		return -1;
-/*	loop = wl_display_get_event_loop(device->seat->compositor->wl_display);
-	touchpad->fsm.timer_source =
-		wl_event_loop_add_timer(loop, fsm_timout_handler, touchpad);
-	if (touchpad->fsm.timer_source == NULL) {
-		accel->interface->destroy(accel);
-		return -1;
-	}*/
-
-	touchpad->device->base.timer_fd = touchpad->fsm.timer_fd;
+	yt_timer_init(&device->timer, fsm_timeout_handler, device);
 
 	/* Configure */
 	touchpad->fsm.enable = !has_buttonpad;
@@ -779,7 +747,9 @@ struct evdev_dispatch *evdev_touchpad_create(struct evdev_device *device)
 {
 	struct touchpad_dispatch *touchpad;
 
-	touchpad = malloc(sizeof *touchpad);
+	/* Zeroed: has_pressure and hw_abs are not set up front by
+	 * touchpad_init(), and a replay must not depend on heap contents */
+	touchpad = calloc(1, sizeof *touchpad);
 	if (touchpad == NULL)
 		return NULL;
 
@@ -790,3 +760,25 @@ struct evdev_dispatch *evdev_touchpad_create(struct evdev_device *device)
 
 	return &touchpad->base;
 }
+
+/* history_length is the number of positions the delta is estimated
+ * from, an even number from 2 to TOUCHPAD_HISTORY_SIZE. smoothing is the
+ * weight of each new delta against the previous ones, in 1/256; 256
+ * leaves them unsmoothed. */
+int touchpad_motion_configure(struct evdev_device *device,
+		unsigned int history_length, unsigned int smoothing)
+{
+	struct touchpad_dispatch *touchpad =
+		(struct touchpad_dispatch *)device->dispatch;
+
+	if (!touchpad || touchpad->base.interface != &touchpad_interface)
+		return -1;
+	if (history_length < 2 || history_length > TOUCHPAD_HISTORY_SIZE ||
+			history_length % 2 || smoothing == 0 || smoothing > 256)
+		return -1;
+
+	touchpad->history_length = history_length;
+	touchpad->smoothing = smoothing;
+	touchpad->reset = 1;
+	return 0;
+}
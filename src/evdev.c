@@ -20,18 +20,32 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <linux/input.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <math.h>
 #include <mtdev.h>
 
 #include <wayland-server.h>
 #include "evdev.h"
 #include "yutani.h"
 #include "common.h"
+#include "thread.h"
+#include "record.h"
+#include "trace.h"
+#include "filter.h"
+#ifdef HAVE_XKBCOMMON
+#include "xkb.h"
+#endif
 
 static inline void evdev_led_state_set(struct evdev_device *device)
 {
@@ -85,16 +99,290 @@ void evdev_led_update(struct evdev_device *device, enum yt_led_state state)
 	evdev_led_state_set(device);
 }
 
-static inline void evdev_process_key(struct evdev_device *device, struct input_event *e, int time)
+static inline uint64_t evdev_now(void)
 {
-	void *data;
-	struct yt_seat_notify_interface *notify = yt_seat_notify_get(device->seat, &data);
+	struct timespec ts;
 
-	/* ignore kernel key repeat */
-	if (e->value == 2)
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline unsigned int evdev_latency_bucket(uint64_t ns)
+{
+	unsigned int msb;
+
+	if (ns < 2 * YT_LATENCY_SUB_BUCKETS)
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+	return (msb - 1) * YT_LATENCY_SUB_BUCKETS +
+		((ns >> (msb - 2)) & (YT_LATENCY_SUB_BUCKETS - 1));
+}
+
+/* Timestamps from another clock, or from a recording, can be ahead of
+ * now; those are not latencies and are left out. */
+static inline void evdev_latency_record(struct evdev_device *device,
+		uint64_t time, uint64_t now)
+{
+	struct yt_latency *latency = &device->latency;
+	uint64_t ns;
+
+	if (time == 0 || time > now)
 		return;
 
-	switch (e->code) {
+	ns = now - time;
+	latency->count++;
+	latency->sum_ns += ns;
+	if (ns > latency->max_ns)
+		latency->max_ns = ns;
+	latency->buckets[evdev_latency_bucket(ns)]++;
+}
+
+static void evdev_event_deliver(struct evdev_device *device,
+		struct yt_seat_notify_interface *notify, void *data,
+		const struct yt_event *ev)
+{
+	struct yt_device *base = (struct yt_device *)device;
+
+	device->time_ns = ev->time_ns;
+	evdev_latency_record(device, ev->time_ns, evdev_now());
+	switch (ev->type) {
+		case YT_EVENT_MOTION:
+			if (!notify->notify_motion)
+				return;
+			notify->notify_motion(base, data, ev->time,
+					ev->motion.dx, ev->motion.dy);
+			break;
+		case YT_EVENT_MOTION_ABSOLUTE:
+			if (!notify->notify_motion_absolute)
+				return;
+			notify->notify_motion_absolute(base, data, ev->time,
+					ev->motion_absolute.x,
+					ev->motion_absolute.y);
+			break;
+		case YT_EVENT_BUTTON:
+			if (!notify->notify_button)
+				return;
+			notify->notify_button(base, data, ev->time,
+					ev->button.button, ev->button.state);
+			break;
+		case YT_EVENT_AXIS:
+			if (!notify->notify_axis)
+				return;
+			notify->notify_axis(base, data, ev->time,
+					ev->axis.axis, ev->axis.value);
+			break;
+		case YT_EVENT_KEY:
+			device->keysym = ev->key.keysym;
+			if (!notify->notify_key)
+				return;
+			notify->notify_key(base, data, ev->time,
+					ev->key.key, ev->key.state,
+					ev->key.update_state);
+			break;
+		case YT_EVENT_TOUCH:
+			if (!notify->notify_touch)
+				return;
+			notify->notify_touch(base, data, ev->time,
+					ev->touch.touch_id,
+					ev->touch.x, ev->touch.y,
+					ev->touch.state);
+			break;
+		case YT_EVENT_TOUCH_FRAME:
+			if (!notify->notify_touch_frame)
+				return;
+			notify->notify_touch_frame(base, data, ev->time);
+			break;
+		case YT_EVENT_MODIFIERS:
+			*yt_seat_modifiers(device->seat) = ev->modifiers;
+			if (!notify->notify_modifiers)
+				return;
+			notify->notify_modifiers(base, data, ev->modifiers.serial);
+			break;
+	}
+	device->stats.callbacks++;
+}
+
+/* Hand the queued frame to notify_frame. Called once per SYN_REPORT and
+ * whenever the queue fills up. */
+void evdev_frame_flush(struct evdev_device *device)
+{
+	struct yt_seat_notify_interface *notify = device->notify;
+	uint64_t now;
+	int i;
+
+	if (device->frame.count == 0)
+		return;
+
+	if (notify->notify_frame) {
+		now = evdev_now();
+		for (i = 0; i < device->frame.count; i++) {
+			evdev_latency_record(device, device->frame.ev[i].time_ns, now);
+			/* What yt_seat_modifiers_get() returns has to match the
+			 * events handed out so far. */
+			if (device->frame.ev[i].type == YT_EVENT_MODIFIERS)
+				*yt_seat_modifiers(device->seat) =
+					device->frame.ev[i].modifiers;
+		}
+		notify->notify_frame((struct yt_device *)device,
+				device->notify_data,
+				device->frame.ev, device->frame.count);
+		device->stats.callbacks++;
+	}
+	device->frame.count = 0;
+}
+
+void evdev_frame_append(struct evdev_device *device, const struct yt_event *event)
+{
+	struct yt_seat_notify_interface *notify = device->notify;
+
+	if (!notify->notify_frame) {
+		evdev_event_deliver(device, notify, device->notify_data, event);
+		return;
+	}
+
+	if (device->frame.count == EVDEV_FRAME_MAX)
+		evdev_frame_flush(device);
+	device->frame.ev[device->frame.count++] = *event;
+}
+
+/* With an input thread the frame is assembled on the compositor side,
+ * once the events came out of the queue. */
+void evdev_notify_frame(struct evdev_device *device)
+{
+	struct yt_thread *thread = yt_seat_thread_get(device->seat);
+
+	if (thread)
+		yt_thread_push_frame(thread, device);
+	else
+		evdev_frame_flush(device);
+}
+
+void evdev_notify_event(struct evdev_device *device, const struct yt_event *event)
+{
+	struct yt_thread *thread = yt_seat_thread_get(device->seat);
+
+	if (thread)
+		yt_thread_push(thread, device, event);
+	else
+		evdev_frame_append(device, event);
+}
+
+/* Internal timestamps are nanoseconds; the legacy millisecond value is
+ * derived from them and wraps like it always did. */
+static inline void evdev_notify_event_at(struct evdev_device *device,
+		struct yt_event *ev, uint64_t time)
+{
+	ev->time = time / 1000000;
+	ev->time_ns = time;
+	evdev_notify_event(device, ev);
+}
+
+void evdev_notify_motion(struct evdev_device *device, uint64_t time,
+		wl_fixed_t dx, wl_fixed_t dy)
+{
+	struct yt_event ev = { .type = YT_EVENT_MOTION };
+
+	ev.motion.dx = dx;
+	ev.motion.dy = dy;
+	device->motion_notified++;
+	evdev_notify_event_at(device, &ev, time);
+}
+
+void evdev_notify_motion_absolute(struct evdev_device *device, uint64_t time,
+		wl_fixed_t x, wl_fixed_t y)
+{
+	struct yt_event ev = { .type = YT_EVENT_MOTION_ABSOLUTE };
+
+	ev.motion_absolute.x = x;
+	ev.motion_absolute.y = y;
+	device->motion_notified++;
+	evdev_notify_event_at(device, &ev, time);
+}
+
+void evdev_notify_button(struct evdev_device *device, uint64_t time,
+		int32_t button, enum yt_button_state state)
+{
+	struct yt_event ev = { .type = YT_EVENT_BUTTON };
+
+	ev.button.button = button;
+	ev.button.state = state;
+	evdev_notify_event_at(device, &ev, time);
+}
+
+void evdev_notify_axis(struct evdev_device *device, uint64_t time,
+		enum yt_axis_type axis, wl_fixed_t value)
+{
+	struct yt_event ev = { .type = YT_EVENT_AXIS };
+
+	ev.axis.axis = axis;
+	ev.axis.value = value;
+	evdev_notify_event_at(device, &ev, time);
+}
+
+void evdev_notify_key(struct evdev_device *device, uint64_t time,
+		uint32_t key, enum yt_key_state state, uint32_t keysym)
+{
+	struct yt_event ev = { .type = YT_EVENT_KEY };
+
+	ev.key.key = key;
+	ev.key.state = state;
+	ev.key.update_state = YT_KEY_STATE_NONE;
+	ev.key.keysym = keysym;
+	evdev_notify_event_at(device, &ev, time);
+}
+
+void evdev_notify_modifiers(struct evdev_device *device, uint64_t time,
+		const struct yt_modifiers *modifiers)
+{
+	struct yt_event ev = { .type = YT_EVENT_MODIFIERS };
+
+	ev.modifiers = *modifiers;
+	evdev_notify_event_at(device, &ev, time);
+}
+
+void evdev_notify_touch(struct evdev_device *device, uint64_t time,
+		int touch_id, wl_fixed_t x, wl_fixed_t y, enum yt_touch_state state)
+{
+	struct yt_event ev = { .type = YT_EVENT_TOUCH };
+
+	ev.touch.touch_id = touch_id;
+	ev.touch.x = x;
+	ev.touch.y = y;
+	ev.touch.state = state;
+	if (state == YT_TOUCH_STATE_MOVE)
+		device->motion_notified++;
+	evdev_notify_event_at(device, &ev, time);
+}
+
+void evdev_notify_touch_frame(struct evdev_device *device, uint64_t time)
+{
+	struct yt_event ev = { .type = YT_EVENT_TOUCH_FRAME };
+
+	evdev_notify_event_at(device, &ev, time);
+}
+
+static const struct {
+	uint16_t offset;
+	uint16_t count;
+} evdev_op_range[EV_CNT] = {
+	[EV_SYN] = { EVDEV_OPS_SYN, SYN_CNT },
+	[EV_KEY] = { EVDEV_OPS_KEY, KEY_CNT },
+	[EV_REL] = { EVDEV_OPS_REL, REL_CNT },
+	[EV_ABS] = { EVDEV_OPS_ABS, ABS_CNT },
+};
+
+static inline uint8_t evdev_op(struct evdev_device *device,
+		const struct input_event *e)
+{
+	if (e->type >= EV_CNT || e->code >= evdev_op_range[e->type].count)
+		return EVDEV_OP_NONE;
+	return device->ops[evdev_op_range[e->type].offset + e->code];
+}
+
+static enum evdev_op evdev_key_op(struct evdev_device *device, unsigned int code)
+{
+	switch (code) {
 		case BTN_LEFT:
 		case BTN_RIGHT:
 		case BTN_MIDDLE:
@@ -103,160 +391,251 @@ static inline void evdev_process_key(struct evdev_device *device, struct input_e
 		case BTN_FORWARD:
 		case BTN_BACK:
 		case BTN_TASK:
-			if (notify && notify->notify_button)
-				notify->notify_button((struct yt_device *)device, data,
-						time, e->code,
-						e->value ? YT_BUTTON_STATE_PRESSED :
-						YT_BUTTON_STATE_RELEASED);
-			break;
+			return EVDEV_OP_BUTTON;
 		case BTN_TOUCH:
-			if (notify->notify_touch && e->value == 0 && !device->is_mt)
-				notify->notify_touch((struct yt_device *)device, data,
-						time, 0, 0, 0,
-						YT_TOUCH_STATE_UP);
-			break;
+			return device->is_mt ? EVDEV_OP_NONE : EVDEV_OP_TOUCH;
 		case KEY_CAPSLOCK:
-			if (e->value)
-				device->led_state ^= YT_LED_CAPS_LOCK;
-			goto notify_key;
 		case KEY_NUMLOCK:
-			if (e->value)
-				device->led_state ^= YT_LED_NUM_LOCK;
-			goto notify_key;
 		case KEY_SCROLLLOCK:
-			if (e->value)
-				device->led_state ^= YT_LED_SCROLL_LOCK;
-			goto notify_key;
+			return EVDEV_OP_KEY_LED;
 		default:
-notify_key:
-			if (notify->notify_key)
-				notify->notify_key((struct yt_device *)device, data,
-						time, e->code,
-						e->value ? YT_KEY_STATE_PRESSED :
-						YT_KEY_STATE_RELEASED,
-						0);
-			break;
+			return EVDEV_OP_KEY;
 	}
 }
 
-static void evdev_process_touch(struct evdev_device *device, struct input_event *e)
+/* Fill in the op table from the probed capabilities. mtdev devices may
+ * send MT codes their caps lack, so those go by is_mt alone. */
+static void evdev_device_build_ops(struct evdev_device *device)
 {
-	switch (e->code) {
-		case ABS_MT_SLOT:
-			device->mt.slot = e->value;
-			break;
-		case ABS_MT_TRACKING_ID:
-			if (e->value >= 0)
-				device->pending_events |= EVDEV_ABSOLUTE_MT_DOWN;
-			else
-				device->pending_events |= EVDEV_ABSOLUTE_MT_UP;
-			break;
-		case ABS_MT_POSITION_X:
-			device->mt.x[device->mt.slot] = e->value;
-			device->pending_events |= EVDEV_ABSOLUTE_MT_MOTION;
-			break;
-		case ABS_MT_POSITION_Y:
-			device->mt.y[device->mt.slot] = e->value;
-			device->pending_events |= EVDEV_ABSOLUTE_MT_MOTION;
-			break;
+	uint8_t *ops = device->ops;
+	unsigned int code;
+
+	memset(ops, EVDEV_OP_NONE, sizeof device->ops);
+
+	ops[EVDEV_OPS_SYN + SYN_REPORT] = EVDEV_OP_SYN_REPORT;
+
+	for (code = 0; code < KEY_CNT; code++)
+		if (TEST_BIT(device->caps.key, code))
+			ops[EVDEV_OPS_KEY + code] = evdev_key_op(device, code);
+
+	ops[EVDEV_OPS_REL + REL_X] = EVDEV_OP_REL_X;
+	ops[EVDEV_OPS_REL + REL_Y] = EVDEV_OP_REL_Y;
+	ops[EVDEV_OPS_REL + REL_WHEEL] = EVDEV_OP_WHEEL;
+	ops[EVDEV_OPS_REL + REL_HWHEEL] = EVDEV_OP_HWHEEL;
+
+	if (device->is_mt) {
+		ops[EVDEV_OPS_ABS + ABS_MT_SLOT] = EVDEV_OP_MT_SLOT;
+		ops[EVDEV_OPS_ABS + ABS_MT_TRACKING_ID] = EVDEV_OP_MT_TRACKING_ID;
+		ops[EVDEV_OPS_ABS + ABS_MT_POSITION_X] = EVDEV_OP_MT_POSITION_X;
+		ops[EVDEV_OPS_ABS + ABS_MT_POSITION_Y] = EVDEV_OP_MT_POSITION_Y;
+	} else {
+		ops[EVDEV_OPS_ABS + ABS_X] = EVDEV_OP_ABS_X;
+		ops[EVDEV_OPS_ABS + ABS_Y] = EVDEV_OP_ABS_Y;
 	}
 }
 
-static inline void evdev_process_absolute_motion(struct evdev_device *device,
-		struct input_event *e)
+/* Up to the keymap if there is one. Otherwise modifiers and locks, which
+ * are held rather than typed, are the keys that do not repeat. */
+static int evdev_key_repeats(struct evdev_device *device __UNUSED__, uint32_t key)
 {
-	switch (e->code) {
-		case ABS_X:
-			device->abs.x = e->value;
-			device->pending_events |= EVDEV_ABSOLUTE_MOTION;
-			break;
-		case ABS_Y:
-			device->abs.y = e->value;
-			device->pending_events |= EVDEV_ABSOLUTE_MOTION;
-			break;
+#ifdef HAVE_XKBCOMMON
+	int repeats = device->xkb ? yt_xkb_key_repeats(device->xkb, key) : -1;
+
+	if (repeats >= 0)
+		return repeats;
+#endif
+
+	switch (key) {
+		case KEY_LEFTCTRL:
+		case KEY_RIGHTCTRL:
+		case KEY_LEFTSHIFT:
+		case KEY_RIGHTSHIFT:
+		case KEY_LEFTALT:
+		case KEY_RIGHTALT:
+		case KEY_LEFTMETA:
+		case KEY_RIGHTMETA:
+		case KEY_CAPSLOCK:
+		case KEY_NUMLOCK:
+		case KEY_SCROLLLOCK:
+			return 0;
+		default:
+			return 1;
 	}
 }
 
-static inline void evdev_process_relative(struct evdev_device *device,
-		struct input_event *e, uint32_t time)
+/* Taken before the key is applied to the state, as clients do */
+static inline uint32_t evdev_key_sym(struct evdev_device *device __UNUSED__,
+		uint32_t key __UNUSED__)
 {
-	void *data;
-	struct yt_seat_notify_interface *notify = yt_seat_notify_get(device->seat, &data);
+#ifdef HAVE_XKBCOMMON
+	if (device->xkb)
+		return yt_xkb_key_get_sym(device->xkb, key);
+#endif
+	return 0;
+}
 
-	switch (e->code) {
-		case REL_X:
-			device->rel.dx += wl_fixed_from_int(e->value);
-			device->pending_events |= EVDEV_RELATIVE_MOTION;
-			break;
-		case REL_Y:
-			device->rel.dy += wl_fixed_from_int(e->value);
-			device->pending_events |= EVDEV_RELATIVE_MOTION;
-			break;
-		case REL_WHEEL:
-			switch (e->value) {
-				case -1:
-					/* Scroll down */
-				case 1:
-					/* Scroll up */
-					if (notify && notify->notify_axis)
-						notify->notify_axis((struct yt_device *)device,
-								data, time,
-								YT_AXIS_TYPE_VERTICAL_SCROLL,
-								-1 * e->value);
-					break;
-				default:
-					break;
-			}
-			break;
-		case REL_HWHEEL:
-			switch (e->value) {
-				case -1:
-					/* Scroll left */
-				case 1:
-					/* Scroll right */
-					if (notify && notify->notify_axis)
-						notify->notify_axis((struct yt_device *)device,
-								data, time,
-								YT_AXIS_TYPE_HORIZONTAL_SCROLL,
-								e->value);
-					break;
-				default:
-					break;
+static void evdev_key_repeat_arm(struct evdev_key_repeat *repeat)
+{
+	struct yt_timer_wheel *timers = repeat->device->timers;
 
-			}
+	if (!timers || (yt_timer_armed(&repeat->timer) &&
+				repeat->timer.deadline == repeat->deadline))
+		return;
+	yt_timer_arm(timers, &repeat->timer, repeat->deadline);
+}
+
+/* Send the repeats due by time, each stamped with its own deadline, so
+ * that they land in the frame being processed. After a long stall only
+ * the last few are sent. */
+static void evdev_key_repeat_catch_up(struct evdev_key_repeat *repeat,
+		uint64_t time)
+{
+	uint32_t keysym;
+	uint64_t n;
+
+	if (repeat->deadline > time)
+		return;
+
+	/* Modifiers pressed meanwhile apply to the repeats */
+	keysym = evdev_key_sym(repeat->device, repeat->key);
+
+	n = (time - repeat->deadline) / repeat->period + 1;
+	if (n > EVDEV_KEY_REPEAT_BURST) {
+		repeat->deadline += (n - EVDEV_KEY_REPEAT_BURST) * repeat->period;
+		n = EVDEV_KEY_REPEAT_BURST;
+	}
+	while (n--) {
+		evdev_notify_key(repeat->device, repeat->deadline, repeat->key,
+				YT_KEY_STATE_REPEAT, keysym);
+		repeat->deadline += repeat->period;
 	}
+
+	evdev_key_repeat_arm(repeat);
 }
 
-static inline void evdev_process_absolute(struct evdev_device *device, struct input_event *e)
+/* The device went quiet while the key is held */
+static void evdev_key_repeat_timeout(struct yt_timer *timer, uint64_t now)
 {
-	if (device->is_mt) {
-		evdev_process_touch(device, e);
-	} else {
-		evdev_process_absolute_motion(device, e);
+	struct evdev_key_repeat *repeat = timer->data;
+	struct evdev_device *device = repeat->device;
+
+	evdev_key_repeat_catch_up(repeat, now);
+	evdev_notify_frame(device);
+}
+
+void evdev_key_repeat_init(struct evdev_key_repeat *repeat)
+{
+	memset(repeat, 0, sizeof *repeat);
+	yt_timer_init(&repeat->timer, evdev_key_repeat_timeout, repeat);
+}
+
+void evdev_key_repeat_stop(struct evdev_key_repeat *repeat)
+{
+	yt_timer_cancel(&repeat->timer);
+	repeat->device = NULL;
+}
+
+static inline void evdev_process_key(struct evdev_device *device,
+		struct input_event *e, uint64_t time)
+{
+	struct evdev_key_repeat *repeat = device->repeat;
+#ifdef HAVE_XKBCOMMON
+	struct yt_modifiers modifiers;
+#endif
+
+	/* Kernel autorepeat is ignored, the seat repeats keys itself */
+	if (e->value == 2)
+		return;
+
+	if (repeat && repeat->device == device)
+		evdev_key_repeat_catch_up(repeat, time);
+
+	evdev_notify_key(device, time, e->code,
+			e->value ? YT_KEY_STATE_PRESSED :
+			YT_KEY_STATE_RELEASED, evdev_key_sym(device, e->code));
+#ifdef HAVE_XKBCOMMON
+	if (device->xkb &&
+			yt_xkb_key_update(device->xkb, e->code, e->value, &modifiers))
+		evdev_notify_modifiers(device, time, &modifiers);
+#endif
+
+	if (!repeat || !repeat->period)
+		return;
+	if (e->value && evdev_key_repeats(device, e->code)) {
+		repeat->device = device;
+		repeat->key = e->code;
+		repeat->deadline = time + repeat->delay;
+		evdev_key_repeat_arm(repeat);
+	} else if (!e->value && repeat->device == device &&
+			repeat->key == e->code) {
+		evdev_key_repeat_stop(repeat);
 	}
 }
 
-static inline int is_motion_event(struct input_event *e)
+static inline void evdev_process_led_key(struct evdev_device *device,
+		struct input_event *e, uint64_t time)
 {
-	switch (e->type) {
-		case EV_REL:
-			switch (e->code) {
-				case REL_X:
-				case REL_Y:
-					return 1;
+	if (e->value == 1) {
+		switch (e->code) {
+			case KEY_CAPSLOCK:
+				device->led_state ^= YT_LED_CAPS_LOCK;
+				break;
+			case KEY_NUMLOCK:
+				device->led_state ^= YT_LED_NUM_LOCK;
+				break;
+			case KEY_SCROLLLOCK:
+				device->led_state ^= YT_LED_SCROLL_LOCK;
+				break;
+		}
+	}
+
+	evdev_process_key(device, e, time);
+}
+
+static void evdev_process_touch(struct evdev_device *device,
+		struct input_event *e, enum evdev_op op)
+{
+	uint32_t bit;
+
+	if (device->mt.slot < 0 || device->mt.slot >= MAX_SLOTS)
+		return;
+	bit = 1u << device->mt.slot;
+
+	switch (op) {
+		case EVDEV_OP_MT_TRACKING_ID:
+			device->mt.tracking_id[device->mt.slot] = e->value;
+			if (e->value >= 0) {
+				/* A new contact replacing a live one */
+				if (device->mt.active & bit)
+					device->mt.up |= bit;
+				device->mt.down |= bit;
+			} else {
+				/* A contact lifted in the frame it appeared in
+				 * is never reported. */
+				device->mt.down &= ~bit;
+				device->mt.up |= bit;
 			}
 			break;
-		case EV_ABS:
-			switch (e->code) {
-				case ABS_X:
-				case ABS_Y:
-				case ABS_MT_POSITION_X:
-				case ABS_MT_POSITION_Y:
-					return 1;
-			}
+		case EVDEV_OP_MT_POSITION_X:
+			device->mt.x[device->mt.slot] = e->value;
+			device->mt.motion |= bit;
+			break;
+		case EVDEV_OP_MT_POSITION_Y:
+			device->mt.y[device->mt.slot] = e->value;
+			device->mt.motion |= bit;
+			break;
+		default:
+			break;
 	}
+}
 
-	return 0;
+/* Only single clicks of the wheel are forwarded */
+static inline void evdev_process_wheel(struct evdev_device *device,
+		struct input_event *e, uint64_t time, enum yt_axis_type axis,
+		int32_t sign)
+{
+	if (e->value == 1 || e->value == -1)
+		evdev_notify_axis(device, time, axis, sign * e->value);
 }
 
 static void transform_absolute(struct evdev_device *device)
@@ -273,79 +652,136 @@ static void transform_absolute(struct evdev_device *device)
 		device->abs.calibration[5];
 }
 
-static void evdev_flush_motion(struct evdev_device *device, uint32_t time)
+/* Emit every slot that changed in this frame, then one touch frame. */
+static void evdev_flush_touch(struct evdev_device *device, uint64_t time)
 {
-	void *data;
-	struct yt_seat_notify_interface *notify = yt_seat_notify_get(device->seat, &data);
+	uint32_t changed = device->mt.down | device->mt.motion | device->mt.up;
+	uint32_t bit;
+	wl_fixed_t x, y;
+	int slot;
 
-	if (!(device->pending_events & EVDEV_SYN))
-		return;
+	while (changed) {
+		slot = __builtin_ctz(changed);
+		bit = 1u << slot;
+		changed &= ~bit;
 
-	device->pending_events &= ~EVDEV_SYN;
-	if (device->pending_events & EVDEV_RELATIVE_MOTION) {
-		if (notify && notify->notify_motion)
-			notify->notify_motion((struct yt_device *)device, data,
-					time, device->rel.dx, device->rel.dy);
-		device->pending_events &= ~EVDEV_RELATIVE_MOTION;
-		device->rel.dx = 0;
-		device->rel.dy = 0;
-	}
-	if (device->pending_events & EVDEV_ABSOLUTE_MT_DOWN) {
-		if (notify && notify->notify_touch)
-			notify->notify_touch((struct yt_device *)device, data,
-					time, device->mt.slot,
-					wl_fixed_from_int(device->mt.x[device->mt.slot]),
-					wl_fixed_from_int(device->mt.y[device->mt.slot]),
+		x = wl_fixed_from_int(device->mt.x[slot]);
+		y = wl_fixed_from_int(device->mt.y[slot]);
+
+		if ((device->mt.up & bit) && (device->mt.active & bit)) {
+			evdev_notify_touch(device, time, slot, x, y,
+					YT_TOUCH_STATE_UP);
+			device->mt.active &= ~bit;
+		}
+		if (device->mt.down & bit) {
+			evdev_notify_touch(device, time, slot, x, y,
 					YT_TOUCH_STATE_DOWN);
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_DOWN;
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_MOTION;
-	}
-	if (device->pending_events & EVDEV_ABSOLUTE_MT_MOTION) {
-		if (notify && notify->notify_touch)
-			notify->notify_touch((struct yt_device *)device, data,
-					time, device->mt.slot,
-					wl_fixed_from_int(device->mt.x[device->mt.slot]),
-					wl_fixed_from_int(device->mt.y[device->mt.slot]),
+			device->mt.active |= bit;
+		} else if ((device->mt.motion & bit) && (device->mt.active & bit)) {
+			evdev_notify_touch(device, time, slot, x, y,
 					YT_TOUCH_STATE_MOVE);
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_DOWN;
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_MOTION;
+		}
 	}
-	if (device->pending_events & EVDEV_ABSOLUTE_MT_UP) {
-		if (notify && notify->notify_touch)
-			notify->notify_touch((struct yt_device *)device, data,
-					time, device->mt.slot,
-					wl_fixed_from_int(device->mt.x[device->mt.slot]),
-					wl_fixed_from_int(device->mt.y[device->mt.slot]),
-					WL_TOUCH_UP);
 
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_UP;
+	device->mt.down = 0;
+	device->mt.motion = 0;
+	device->mt.up = 0;
+
+	evdev_notify_touch_frame(device, time);
+}
+
+/* Runs at every SYN_REPORT, whatever the dispatch did with the frame */
+static void evdev_flush_motion(struct evdev_device *device, uint64_t time)
+{
+	YT_TRACE3(flush, device->base.devnode, device->pending_events, time);
+	if (device->pending_events & EVDEV_RELATIVE_MOTION) {
+		if (device->accel)
+			filter_dispatch(device->accel, &device->rel.dx,
+					&device->rel.dy, time);
+		evdev_notify_motion(device, time, device->rel.dx, device->rel.dy);
+		device->pending_events &= ~EVDEV_RELATIVE_MOTION;
+		device->rel.dx = 0;
+		device->rel.dy = 0;
 	}
+	if (device->mt.down | device->mt.motion | device->mt.up)
+		evdev_flush_touch(device, time);
 	if (device->pending_events & EVDEV_ABSOLUTE_MOTION) {
 		transform_absolute(device);
-		if (notify && notify->notify_motion_absolute)
-			notify->notify_motion_absolute((struct yt_device *)device, data,
-					time, wl_fixed_from_int(device->abs.x),
-					wl_fixed_from_int(device->abs.y));
+		evdev_notify_motion_absolute(device, time,
+				wl_fixed_from_int(device->abs.x),
+				wl_fixed_from_int(device->abs.y));
 		device->pending_events &= ~EVDEV_ABSOLUTE_MOTION;
 	}
 }
 
 static void fallback_process(struct evdev_dispatch *dispatch __UNUSED__,
 		struct evdev_device *device,
-		struct input_event *event, uint32_t time)
+		struct input_event *event, uint64_t time)
 {
-	switch (event->type) {
-		case EV_REL:
-			evdev_process_relative(device, event, time);
-			break;
-		case EV_ABS:
-			evdev_process_absolute(device, event);
+	enum evdev_op op = evdev_op(device, event);
+
+	switch (op) {
+		case EVDEV_OP_NONE:
+			device->stats.events_dropped++;
 			break;
-		case EV_KEY:
+		case EVDEV_OP_KEY:
 			evdev_process_key(device, event, time);
 			break;
-		case EV_SYN:
-			device->pending_events |= EVDEV_SYN;
+		case EVDEV_OP_KEY_LED:
+			evdev_process_led_key(device, event, time);
+			break;
+		case EVDEV_OP_BUTTON:
+			if (event->value != 2)
+				evdev_notify_button(device, time, event->code,
+						event->value ? YT_BUTTON_STATE_PRESSED :
+						YT_BUTTON_STATE_RELEASED);
+			break;
+		case EVDEV_OP_TOUCH:
+			if (event->value == 0)
+				evdev_notify_touch(device, time, 0, 0, 0,
+						YT_TOUCH_STATE_UP);
+			break;
+		case EVDEV_OP_REL_X:
+			device->rel.dx += wl_fixed_from_int(event->value);
+			device->pending_events |= EVDEV_RELATIVE_MOTION;
+			break;
+		case EVDEV_OP_REL_Y:
+			device->rel.dy += wl_fixed_from_int(event->value);
+			device->pending_events |= EVDEV_RELATIVE_MOTION;
+			break;
+		case EVDEV_OP_WHEEL:
+			/* Wheel up is a negative axis value */
+			evdev_process_wheel(device, event, time,
+					YT_AXIS_TYPE_VERTICAL_SCROLL, -1);
+			break;
+		case EVDEV_OP_HWHEEL:
+			evdev_process_wheel(device, event, time,
+					YT_AXIS_TYPE_HORIZONTAL_SCROLL, 1);
+			break;
+		case EVDEV_OP_ABS_X:
+			device->abs.x = event->value;
+			device->pending_events |= EVDEV_ABSOLUTE_MOTION;
+			break;
+		case EVDEV_OP_ABS_Y:
+			device->abs.y = event->value;
+			device->pending_events |= EVDEV_ABSOLUTE_MOTION;
+			break;
+		case EVDEV_OP_MT_SLOT:
+			device->mt.slot = event->value;
+			break;
+		case EVDEV_OP_MT_TRACKING_ID:
+		case EVDEV_OP_MT_POSITION_X:
+		case EVDEV_OP_MT_POSITION_Y:
+			evdev_process_touch(device, event, op);
+			break;
+		case EVDEV_OP_SYN_REPORT:
+			/* The frame is flushed by evdev_process_event(). Each
+			 * axis pair and each moved touch that is not new is
+			 * one motion sample. */
+			device->motion_samples +=
+				!!(device->pending_events & EVDEV_RELATIVE_MOTION) +
+				!!(device->pending_events & EVDEV_ABSOLUTE_MOTION) +
+				__builtin_popcount(device->mt.motion & ~device->mt.down);
 			break;
 	}
 }
@@ -355,74 +791,420 @@ static void fallback_destroy(struct evdev_dispatch *dispatch __UNUSED__)
 	return;
 }
 
+static void fallback_event_mask(struct evdev_dispatch *dispatch __UNUSED__,
+		struct evdev_device *device, struct evdev_event_mask *mask)
+{
+	unsigned int code;
+
+	/* Every key is forwarded, except the tool bits nobody listens to */
+	memcpy(mask->key, device->caps.key, sizeof mask->key);
+	for (code = BTN_TOOL_PEN; code <= BTN_TOOL_QUINTTAP; code++)
+		CLEAR_BIT(mask->key, code);
+	for (code = BTN_TOOL_DOUBLETAP; code <= BTN_TOOL_QUADTAP; code++)
+		CLEAR_BIT(mask->key, code);
+	if (device->is_mt)
+		CLEAR_BIT(mask->key, BTN_TOUCH);
+
+	SET_BIT(mask->rel, REL_X);
+	SET_BIT(mask->rel, REL_Y);
+	SET_BIT(mask->rel, REL_WHEEL);
+	SET_BIT(mask->rel, REL_HWHEEL);
+
+	if (device->is_mt) {
+		SET_BIT(mask->abs, ABS_MT_SLOT);
+		SET_BIT(mask->abs, ABS_MT_TRACKING_ID);
+		SET_BIT(mask->abs, ABS_MT_POSITION_X);
+		SET_BIT(mask->abs, ABS_MT_POSITION_Y);
+	} else {
+		SET_BIT(mask->abs, ABS_X);
+		SET_BIT(mask->abs, ABS_Y);
+	}
+}
+
 struct evdev_dispatch_interface fallback_interface = {
 	fallback_process,
-	fallback_destroy
+	fallback_destroy,
+	fallback_event_mask
 };
 
 static struct evdev_dispatch fallback_dispatch = {
 	.interface = &fallback_interface
 };
 
-static void evdev_process_events(struct evdev_device *device,
-		struct input_event *ev, int count)
+static void evdev_process_event(struct evdev_device *device, struct input_event *e)
 {
 	struct evdev_dispatch *dispatch = device->dispatch;
+	uint64_t time = (uint64_t)e->time.tv_sec * 1000000000 +
+		e->time.tv_usec * 1000;
+
+	switch (e->type) {
+		case EV_KEY:
+			if (e->value == 1)
+				device->sync.key[LONG(e->code)] |= BIT(e->code);
+			else if (e->value == 0)
+				device->sync.key[LONG(e->code)] &= ~BIT(e->code);
+			break;
+		case EV_ABS:
+			if (e->code < ABS_MT_SLOT)
+				device->sync.abs[e->code] = e->value;
+			break;
+	}
+
+	dispatch->interface->process(dispatch, device, e, time);
+
+	/* we try to minimize the amount of notifications to be
+	 * forwarded to the compositor, so everything of a frame is
+	 * accumulated and flushed once at its SYN_REPORT. A frame
+	 * split across reads simply continues with the next read. */
+	if (e->type == EV_SYN && e->code == SYN_REPORT) {
+		if (device->repeat && device->repeat->device == device)
+			evdev_key_repeat_catch_up(device->repeat, time);
+		evdev_flush_motion(device, time);
+		evdev_notify_frame(device);
+	}
+}
+
+static void evdev_sync_event(struct evdev_device *device, struct timeval *time,
+		uint16_t type, uint16_t code, int32_t value)
+{
+	struct input_event e;
+
+	e.time = *time;
+	e.type = type;
+	e.code = code;
+	e.value = value;
+	evdev_process_event(device, &e);
+}
+
+static void evdev_sync_slots(struct evdev_device *device, struct timeval *time)
+{
+	static const uint16_t codes[] = {
+		ABS_MT_TRACKING_ID, ABS_MT_POSITION_X, ABS_MT_POSITION_Y
+	};
+	struct {
+		uint32_t code;
+		int32_t values[MAX_SLOTS];
+	} slots[ARRAY_LENGTH(codes)];
+	struct input_absinfo absinfo;
+	unsigned int i;
+	int slot, id, count;
+
+	/* The kernel only fills in the slots the device has */
+	count = device->caps.absinfo[ABS_MT_SLOT].maximum + 1;
+	if (count > MAX_SLOTS)
+		count = MAX_SLOTS;
+
+	for (i = 0; i < ARRAY_LENGTH(codes); i++) {
+		slots[i].code = codes[i];
+		memset(slots[i].values, 0xff, sizeof slots[i].values);
+		if (ioctl(device->base.fd, EVIOCGMTSLOTS(sizeof slots[i]), &slots[i]) < 0)
+			return;
+	}
+
+	for (slot = 0; slot < count; slot++) {
+		id = slots[0].values[slot];
+		if (id == device->mt.tracking_id[slot] &&
+				(id < 0 || (slots[1].values[slot] == device->mt.x[slot] &&
+					    slots[2].values[slot] == device->mt.y[slot])))
+			continue;
+
+		evdev_sync_event(device, time, EV_ABS, ABS_MT_SLOT, slot);
+		if (id != device->mt.tracking_id[slot])
+			evdev_sync_event(device, time, EV_ABS,
+					ABS_MT_TRACKING_ID, id);
+		if (id >= 0) {
+			evdev_sync_event(device, time, EV_ABS,
+					ABS_MT_POSITION_X, slots[1].values[slot]);
+			evdev_sync_event(device, time, EV_ABS,
+					ABS_MT_POSITION_Y, slots[2].values[slot]);
+		}
+	}
+
+	if (ioctl(device->base.fd, EVIOCGABS(ABS_MT_SLOT), &absinfo) == 0)
+		evdev_sync_event(device, time, EV_ABS, ABS_MT_SLOT, absinfo.value);
+}
+
+/* The kernel dropped events: query the current state and feed only what
+ * differs from what we saw through the dispatch as one synthetic frame. */
+static void evdev_sync_state(struct evdev_device *device, struct timeval *time)
+{
+	unsigned long key_bits[NBITS(KEY_CNT)];
+	struct input_absinfo absinfo;
+	unsigned long diff;
+	unsigned int i, code;
+
+	if (TEST_BIT(device->caps.ev, EV_KEY) &&
+			ioctl(device->base.fd, EVIOCGKEY(sizeof(key_bits)), key_bits) >= 0) {
+		for (i = 0; i < ARRAY_LENGTH(key_bits); i++) {
+			diff = key_bits[i] ^ device->sync.key[i];
+			/* Filtered keys were never seen changing */
+			if (device->mask.enabled)
+				diff &= device->mask.key[i];
+			while (diff) {
+				code = i * BITS_PER_LONG + __builtin_ctzl(diff);
+				diff &= diff - 1;
+				evdev_sync_event(device, time, EV_KEY, code,
+						TEST_BIT(key_bits, code));
+			}
+		}
+	}
+
+	if (TEST_BIT(device->caps.ev, EV_ABS)) {
+		for (code = 0; code < ABS_MT_SLOT; code++) {
+			if (!TEST_BIT(device->caps.abs, code) ||
+					(device->mask.enabled &&
+					 !TEST_BIT(device->mask.abs, code)) ||
+					ioctl(device->base.fd, EVIOCGABS(code), &absinfo) < 0)
+				continue;
+			if (absinfo.value != device->sync.abs[code])
+				evdev_sync_event(device, time, EV_ABS, code,
+						absinfo.value);
+		}
+
+		/* mtdev devices have no kernel slots to query */
+		if (device->is_mt && device->mt.has_slots)
+			evdev_sync_slots(device, time);
+	}
+
+	evdev_sync_event(device, time, EV_SYN, SYN_REPORT, 0);
+}
+
+void evdev_process_events(struct evdev_device *device,
+		struct input_event *ev, int count)
+{
 	struct input_event *e, *end;
-	uint32_t time = 0;
 
-	device->pending_events = 0;
+	device->stats.events_read += count;
 
-	e = ev;
-	end = e + count;
+	end = ev + count;
 	for (e = ev; e < end; e++) {
-		time = e->time.tv_sec * 1000 + e->time.tv_usec / 1000;
+		/* After SYN_DROPPED everything up to and including the next
+		 * SYN_REPORT is incomplete and gets replaced by a resync. */
+		if (device->sync.dropped) {
+			if (e->type == EV_SYN && e->code == SYN_REPORT) {
+				device->sync.dropped = 0;
+				evdev_sync_state(device, &e->time);
+			}
+			device->stats.events_desynced++;
+			continue;
+		}
+
+		if (e->type == EV_SYN && e->code == SYN_DROPPED) {
+			device->sync.dropped = 1;
+			device->stats.events_desynced++;
+			continue;
+		}
 
-		/* we try to minimize the amount of notifications to be
-		 * forwarded to the compositor, so we accumulate motion
-		 * events and send as a bunch */
-		if (!is_motion_event(e))
-			evdev_flush_motion(device, time);
+		if (evdev_op(device, e) == EVDEV_OP_SYN_REPORT)
+			device->stats.syn_frames++;
 
-		dispatch->interface->process(dispatch, device, e, time);
+		evdev_process_event(device, e);
 	}
+}
+
+/* Events fresh from the device, as opposed to replayed ones */
+void evdev_device_input(struct evdev_device *device,
+		struct input_event *ev, int count)
+{
+	if (device->recorder)
+		yt_recorder_write(device->recorder, ev, count);
 
-	evdev_flush_motion(device, time);
+	evdev_process_events(device, ev, count);
+}
+
+/* Kernels before 4.4 lack EVIOCSMASK; they simply keep sending
+ * everything. */
+int evdev_device_install_mask(struct evdev_device *device)
+{
+	struct evdev_event_mask *mask = &device->mask;
+	struct {
+		unsigned int type;
+		unsigned long *codes;
+		size_t size;
+	} types[] = {
+		{ EV_KEY, mask->key, sizeof mask->key },
+		{ EV_REL, mask->rel, sizeof mask->rel },
+		{ EV_ABS, mask->abs, sizeof mask->abs },
+		{ EV_MSC, mask->msc, sizeof mask->msc },
+		{ EV_SW, mask->sw, sizeof mask->sw },
+	};
+	struct input_mask im;
+	unsigned int i;
+
+	if (!mask->enabled || device->base.fd < 0)
+		return 0;
+
+	for (i = 0; i < ARRAY_LENGTH(types); i++) {
+		im.type = types[i].type;
+		im.codes_size = types[i].size;
+		im.codes_ptr = (uint64_t)(uintptr_t)types[i].codes;
+		if (ioctl(device->base.fd, EVIOCSMASK, &im) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* What a resync compares against starts out as the state at open, so
+ * the first SYN_DROPPED does not replay keys already held or axes that
+ * were never at zero. */
+static void evdev_sync_seed(struct evdev_device *device)
+{
+	struct input_absinfo absinfo;
+	unsigned int code;
+
+	memset(device->sync.key, 0, sizeof device->sync.key);
+	if (TEST_BIT(device->caps.ev, EV_KEY))
+		ioctl(device->base.fd, EVIOCGKEY(sizeof(device->sync.key)),
+				device->sync.key);
+
+	for (code = 0; code < ABS_MT_SLOT; code++) {
+		if (!TEST_BIT(device->caps.abs, code))
+			continue;
+		if (ioctl(device->base.fd, EVIOCGABS(code), &absinfo) == 0)
+			device->sync.abs[code] = absinfo.value;
+		else
+			device->sync.abs[code] = device->caps.absinfo[code].value;
+	}
+}
+
+/* Called whenever the device fd was (re)opened. */
+void evdev_device_setup_fd(struct evdev_device *device)
+{
+	struct input_absinfo absinfo;
+	int clock = CLOCK_MONOTONIC;
+
+	/* Event times have to be comparable with our own timers */
+	if (ioctl(device->base.fd, EVIOCSCLOCKID, &clock) < 0)
+		fprintf(stderr, "%s: failed to select monotonic clock: %m\n",
+				device->base.devnode);
+
+	/* The kernel only reports ABS_MT_SLOT when it changes, so pick up
+	 * the slot that is current right now. */
+	if (device->is_mt && device->mt.has_slots &&
+			ioctl(device->base.fd, EVIOCGABS(ABS_MT_SLOT), &absinfo) == 0)
+		device->mt.slot = absinfo.value;
+
+	evdev_sync_seed(device);
+	evdev_device_install_mask(device);
+}
+
+static int evdev_buffer_resize(struct evdev_device *device, unsigned int size)
+{
+	struct input_event *ev;
+
+	ev = realloc(device->buffer.ev, size * sizeof *ev);
+	if (ev == NULL)
+		return -1;
+
+	device->buffer.ev = ev;
+	device->buffer.size = size;
+	return 0;
+}
+
+/* Track the largest burst seen recently and shrink the buffer back when
+ * the device has calmed down. The peak decays by 1/16 per wakeup. */
+static void evdev_buffer_adapt(struct evdev_device *device, unsigned int burst)
+{
+	unsigned int peak = device->buffer.peak;
+
+	peak -= peak / 16;
+	if (burst > peak)
+		peak = burst;
+	device->buffer.peak = peak;
+
+	if (device->buffer.size > EVDEV_BUFFER_MIN &&
+			peak < device->buffer.size / 4)
+		evdev_buffer_resize(device, device->buffer.size / 2);
 }
 
 int evdev_device_data(int fd, uint32_t mask __UNUSED__, void *data)
 {
 	struct evdev_device *device = data;
-	struct input_event ev[32];
-	int len;
+	unsigned int burst = 0;
+	int len, count, full;
 
 	/* If the compositor is repainting, this function is called only once
 	 * per frame and we have to process all the events available on the
 	 * fd, otherwise there will be input lag. */
 	do {
-		if (device->mtdev)
-			len = mtdev_get(device->mtdev, fd, ev, ARRAY_LENGTH(ev)) * sizeof(struct input_event);
-		else
-			len = read(fd, &ev, sizeof ev);
+		device->stats.syscalls++;
+		YT_TRACE2(read_start, fd, device->buffer.size);
+		if (device->mtdev) {
+			device->stats.mtdev_reads++;
+			count = mtdev_get(device->mtdev, fd, device->buffer.ev,
+					device->buffer.size);
+		} else {
+			len = read(fd, device->buffer.ev,
+					device->buffer.size * sizeof(struct input_event));
+			if (len < 0 || len % sizeof(struct input_event) != 0)
+				count = -1;
+			else
+				count = len / sizeof(struct input_event);
+		}
+
+		YT_TRACE2(read_end, fd, count);
 
-		if (len < 0 || len % sizeof ev[0] != 0) {
+		if (count < 0) {
+			if (errno != EAGAIN)
+				device->stats.read_errors++;
 			/* FIXME: call evdev_device_destroy when errno is ENODEV. */
-			return 1;
+			break;
 		}
 
-		evdev_process_events(device, ev, len / sizeof ev[0]);
-	} while (len > 0);
+		evdev_device_input(device, device->buffer.ev, count);
+		burst += count;
+
+		/* The kernel hands out everything queued up to the size we
+		 * ask for, so a short read means the fd is drained and the
+		 * extra read() returning EAGAIN can be skipped. A full read
+		 * means the buffer is too small for this device. */
+		full = (unsigned int)count == device->buffer.size;
+		if (full && device->buffer.size < EVDEV_BUFFER_MAX)
+			evdev_buffer_resize(device, device->buffer.size * 2);
+	} while (full);
+
+	evdev_buffer_adapt(device, burst);
 
 	return 1;
 }
 
+/* Query everything the dispatch needs from the kernel in one go. */
+static int evdev_caps_probe(int fd, struct evdev_caps *caps)
+{
+	unsigned int code;
+
+	memset(caps, 0, sizeof *caps);
+	strcpy(caps->name, "unknown");
+	ioctl(fd, EVIOCGNAME(sizeof(caps->name) - 1), caps->name);
+	ioctl(fd, EVIOCGID, &caps->id);
+	ioctl(fd, EVIOCGPROP(sizeof(caps->props)), caps->props);
+
+	if (ioctl(fd, EVIOCGBIT(0, sizeof(caps->ev)), caps->ev) < 0)
+		return -1;
+	if (TEST_BIT(caps->ev, EV_KEY))
+		ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(caps->key)), caps->key);
+	if (TEST_BIT(caps->ev, EV_REL))
+		ioctl(fd, EVIOCGBIT(EV_REL, sizeof(caps->rel)), caps->rel);
+	if (TEST_BIT(caps->ev, EV_LED))
+		ioctl(fd, EVIOCGBIT(EV_LED, sizeof(caps->led)), caps->led);
+	if (TEST_BIT(caps->ev, EV_ABS)) {
+		ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(caps->abs)), caps->abs);
+		for (code = 0; code < ABS_CNT; code++)
+			if (TEST_BIT(caps->abs, code))
+				ioctl(fd, EVIOCGABS(code), &caps->absinfo[code]);
+	}
+
+	return 0;
+}
+
 static int evdev_handle_device(struct evdev_device *device)
 {
-	struct input_absinfo absinfo;
-	unsigned long ev_bits[NBITS(EV_MAX)];
-	unsigned long abs_bits[NBITS(ABS_MAX)];
-	unsigned long rel_bits[NBITS(REL_MAX)];
-	unsigned long key_bits[NBITS(KEY_MAX)];
+	struct evdev_caps *caps = &device->caps;
+	unsigned long *ev_bits = caps->ev;
+	unsigned long *abs_bits = caps->abs;
+	unsigned long *rel_bits = caps->rel;
+	unsigned long *key_bits = caps->key;
 	int has_key, has_abs;
 	unsigned int i;
 
@@ -430,47 +1212,38 @@ static int evdev_handle_device(struct evdev_device *device)
 	has_abs = 0;
 	device->base.caps = 0;
 
-	ioctl(device->base.fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits);
 	if (TEST_BIT(ev_bits, EV_ABS)) {
 		has_abs = 1;
 
-		ioctl(device->base.fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)),
-				abs_bits);
 		if (TEST_BIT(abs_bits, ABS_X)) {
-			ioctl(device->base.fd, EVIOCGABS(ABS_X), &absinfo);
-			device->abs.min_x = absinfo.minimum;
-			device->abs.max_x = absinfo.maximum;
+			device->abs.min_x = caps->absinfo[ABS_X].minimum;
+			device->abs.max_x = caps->absinfo[ABS_X].maximum;
 			device->base.caps |= YT_MOTION_ABS;
 		}
 		if (TEST_BIT(abs_bits, ABS_Y)) {
-			ioctl(device->base.fd, EVIOCGABS(ABS_Y), &absinfo);
-			device->abs.min_y = absinfo.minimum;
-			device->abs.max_y = absinfo.maximum;
+			device->abs.min_y = caps->absinfo[ABS_Y].minimum;
+			device->abs.max_y = caps->absinfo[ABS_Y].maximum;
 			device->base.caps |= YT_MOTION_ABS;
 		}
-		if (TEST_BIT(abs_bits, ABS_MT_SLOT)) {
-			ioctl(device->base.fd, EVIOCGABS(ABS_MT_POSITION_X),
-					&absinfo);
-			device->abs.min_x = absinfo.minimum;
-			device->abs.max_x = absinfo.maximum;
-			ioctl(device->base.fd, EVIOCGABS(ABS_MT_POSITION_Y),
-					&absinfo);
-			device->abs.min_y = absinfo.minimum;
-			device->abs.max_y = absinfo.maximum;
+		if (TEST_BIT(abs_bits, ABS_MT_POSITION_X)) {
+			device->abs.min_x = caps->absinfo[ABS_MT_POSITION_X].minimum;
+			device->abs.max_x = caps->absinfo[ABS_MT_POSITION_X].maximum;
+			device->abs.min_y = caps->absinfo[ABS_MT_POSITION_Y].minimum;
+			device->abs.max_y = caps->absinfo[ABS_MT_POSITION_Y].maximum;
 			device->is_mt = 1;
 			device->mt.slot = 0;
+			/* Protocol B devices already report slots and are read
+			 * directly; only protocol A ones go through mtdev. */
+			device->mt.has_slots = TEST_BIT(abs_bits, ABS_MT_SLOT);
 			device->base.caps |= YT_TOUCH;
 		}
 	}
 	if (TEST_BIT(ev_bits, EV_REL)) {
-		ioctl(device->base.fd, EVIOCGBIT(EV_REL, sizeof(rel_bits)),
-				rel_bits);
 		if (TEST_BIT(rel_bits, REL_X) || TEST_BIT(rel_bits, REL_Y))
 			device->base.caps |= YT_MOTION_REL;
 	}
 	if (TEST_BIT(ev_bits, EV_KEY)) {
 		has_key = 1;
-		ioctl(device->base.fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits);
 		if (TEST_BIT(key_bits, BTN_TOOL_FINGER) &&
 				!TEST_BIT(key_bits, BTN_TOOL_PEN) && has_abs)
 			device->dispatch = evdev_touchpad_create(device);
@@ -536,10 +1309,9 @@ static int evdev_configure_device(struct evdev_device *device)
 	return 0;
 }*/
 
-struct evdev_device *evdev_device_create(const char *path)
+static struct evdev_device *evdev_device_alloc(const char *path)
 {
 	struct evdev_device *device;
-	char devname[256] = "unknown";
 
 	device = calloc(1, sizeof(struct evdev_device));
 	if (device == NULL)
@@ -552,19 +1324,37 @@ struct evdev_device *evdev_device_create(const char *path)
 	device->rel.dx = 0;
 	device->rel.dy = 0;
 	device->dispatch = NULL;
+	device->base.fd = -1;
+	device->base.timer_fd = -1;
+	yt_timer_init(&device->timer, NULL, device);
+	memset(device->mt.tracking_id, 0xff, sizeof device->mt.tracking_id);
 
-	device->base.fd = open(path, O_RDWR | O_CLOEXEC);
-	if (device->base.fd < 0) {
-		fprintf(stderr, "Failed to open %s: %m\n", path);
-		goto err1;
+	device->buffer.ev = NULL;
+	device->buffer.peak = 0;
+	if (evdev_buffer_resize(device, EVDEV_BUFFER_MIN) < 0) {
+		free(device->base.devnode);
+		free(device);
+		return NULL;
 	}
 
-	ioctl(device->base.fd, EVIOCGNAME(sizeof(devname)), devname);
-	device->base.devname = strdup(devname);
+	return device;
+}
 
-	if (!evdev_handle_device(device)) {
-		goto err1;
-	}
+static void evdev_device_free(struct evdev_device *device)
+{
+	if (!(device->base.fd < 0))
+		close(device->base.fd);
+	free(device->buffer.ev);
+	free(device->base.devname);
+	free(device->base.devnode);
+	free(device);
+}
+
+/* Pick the dispatch for the probed caps. */
+static int evdev_device_configure(struct evdev_device *device)
+{
+	if (!evdev_handle_device(device))
+		return -1;
 
 /*	if (evdev_configure_device(device) == -1)
 		goto err1;
@@ -573,30 +1363,173 @@ struct evdev_device *evdev_device_create(const char *path)
 	if (device->dispatch == NULL)
 		device->dispatch = &fallback_dispatch;
 
-	if (device->is_mt) {
+	evdev_device_build_ops(device);
+
+	if (device->accel_diagonal > 0 ||
+			(TEST_BIT(device->caps.rel, REL_X) &&
+			 TEST_BIT(device->caps.rel, REL_Y)))
+		evdev_device_accel_set(device, YT_ACCEL_PROFILE_ADAPTIVE, 0.0);
+
+	if (device->is_mt && !device->mt.has_slots && !(device->base.fd < 0)) {
 		device->mtdev = mtdev_new_open(device->base.fd);
 		if (!device->mtdev)
-			fprintf(stderr, "mtdev failed to open for %s\n", path);
+			fprintf(stderr, "mtdev failed to open for %s\n",
+					device->base.devnode);
 	}
 
+	/* mtdev needs the raw protocol A stream, so leave those alone */
+	if (device->dispatch->interface->event_mask && !device->mtdev) {
+		device->dispatch->interface->event_mask(device->dispatch,
+				device, &device->mask);
+		device->mask.enabled = 1;
+	}
+
+	return 0;
+}
+
+/* speed runs from -1 to 1 and scales every factor by 2^speed. The mouse
+ * curve is 1 up to 2 units/ms and grows to 2.5 from there; touchpads use
+ * weston's profile, proportional to velocity over the diagonal. */
+int evdev_device_accel_set(struct evdev_device *device,
+		enum yt_accel_profile profile, double speed)
+{
+	struct motion_filter *filter = NULL;
+	struct accel_linear params;
+	double gain;
+
+	if (speed < -1.0 || speed > 1.0)
+		return -1;
+	gain = exp2(speed);
+
+	switch (profile) {
+		case YT_ACCEL_PROFILE_NONE:
+			break;
+		case YT_ACCEL_PROFILE_FLAT:
+			params.min = params.max = params.offset = gain;
+			params.slope = 0.0;
+			break;
+		case YT_ACCEL_PROFILE_ADAPTIVE:
+			if (device->accel_diagonal > 0) {
+				params.min = 0.16 * gain;
+				params.max = 1.0 * gain;
+				params.offset = 0.0;
+				params.slope = 50.0 / device->accel_diagonal * gain;
+			} else {
+				params.min = 1.0 * gain;
+				params.max = 2.5 * gain;
+				params.offset = 0.7 * gain;
+				params.slope = 0.15 * gain;
+			}
+			break;
+		default:
+			return -1;
+	}
+
+	if (profile != YT_ACCEL_PROFILE_NONE) {
+		filter = create_pointer_accelerator_filter(accel_profile_linear,
+				&params);
+		if (filter == NULL)
+			return -1;
+	}
+
+	filter_destroy(device->accel);
+	device->accel = filter;
+	return 0;
+}
+
+/* The seat's notify vtable is resolved here once, not per event */
+/* Called with the seat's thread lock held, if it has an input thread:
+ * the timers and key repeat dropped here are the thread's as well. */
+void evdev_device_set_seat(struct evdev_device *device, struct yt_seat *seat)
+{
+	/* A pending deadline would fire on the old seat's wheel */
+	yt_timer_cancel(&device->timer);
+	if (device->repeat && device->repeat->device == device)
+		evdev_key_repeat_stop(device->repeat);
+
+	device->seat = seat;
+	if (seat) {
+		device->notify = yt_seat_notify_get(seat, &device->notify_data);
+		device->timers = yt_seat_timers_get(seat);
+		device->repeat = yt_seat_key_repeat_get(seat);
+		device->xkb = yt_seat_xkb_get(seat);
+	} else {
+		device->notify = NULL;
+		device->notify_data = NULL;
+		device->timers = NULL;
+		device->repeat = NULL;
+		device->xkb = NULL;
+	}
+}
+
+struct evdev_device *evdev_device_create(const char *path)
+{
+	struct evdev_device *device;
+
+	device = evdev_device_alloc(path);
+	if (device == NULL)
+		return NULL;
+
+	device->base.fd = open(path, O_RDWR | O_CLOEXEC);
+	if (device->base.fd < 0) {
+		fprintf(stderr, "Failed to open %s: %m\n", path);
+		goto err1;
+	}
+
+	if (evdev_caps_probe(device->base.fd, &device->caps) < 0) {
+		fprintf(stderr, "Failed to probe %s: %m\n", path);
+		goto err1;
+	}
+	device->base.devname = strdup(device->caps.name);
+
+	if (evdev_device_configure(device) < 0)
+		goto err1;
+
+	/* Reopened non-blocking once the device joins a seat */
 	close(device->base.fd);
+	device->base.fd = -1;
 	return device;
 
 //err2:
 //	device->dispatch->interface->destroy(device->dispatch);
 err1:
-	if (!(device->base.fd < 0))
-		close(device->base.fd);
-	free(device->base.devname);
-	free(device->base.devnode);
-	free(device);
+	evdev_device_free(device);
 	return NULL;
 }
 
+/* A device known only by its capabilities, e.g. from a recording. There
+ * is no kernel node behind it, so multitouch is taken to be protocol B
+ * and events have to be fed in by the caller. */
+struct evdev_device *evdev_device_create_from_caps(const struct evdev_caps *caps,
+		const char *path)
+{
+	struct evdev_device *device;
+
+	device = evdev_device_alloc(path);
+	if (device == NULL)
+		return NULL;
+
+	device->caps = *caps;
+	device->caps.name[sizeof(device->caps.name) - 1] = '\0';
+	device->base.devname = strdup(device->caps.name);
+
+	if (evdev_device_configure(device) < 0) {
+		evdev_device_free(device);
+		return NULL;
+	}
+	if (device->is_mt)
+		device->mt.has_slots = 1;
+
+	return device;
+}
+
 void evdev_device_destroy(struct evdev_device *device)
 {
 	struct evdev_dispatch *dispatch;
 
+	if (device->seat)
+		yt_device_del_from_seat(&device->base, device->seat);
+
 	dispatch = device->dispatch;
 	if (dispatch)
 		dispatch->interface->destroy(dispatch);
@@ -609,9 +1542,7 @@ void evdev_device_destroy(struct evdev_device *device)
 
 	if (device->mtdev)
 		mtdev_close_delete(device->mtdev);
-	if (!(device->base.fd < 0))
-		close(device->base.fd);
-	free(device->base.devname);
-	free(device->base.devnode);
-	free(device);
+	yt_recorder_destroy(device->recorder);
+	filter_destroy(device->accel);
+	evdev_device_free(device);
 }
@@ -26,17 +26,108 @@
 #include <linux/input.h>
 #include <wayland-util.h>
 #include "yutani.h"
+#include "timer.h"
 
 #define MAX_SLOTS 16
 #define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
 
+/* Bounds for the per-device read buffer, in events. The buffer grows when
+ * a read fills it and shrinks again once bursts stay small. */
+#define EVDEV_BUFFER_MIN 64
+#define EVDEV_BUFFER_MAX 4096
+
+/* Events queued for notify_frame before a frame is handed out early. */
+#define EVDEV_FRAME_MAX 32
+
+/* Key repeats sent at once when they fell behind; older ones are dropped. */
+#define EVDEV_KEY_REPEAT_BURST 4
+
+/* What the fallback dispatch does with an event. Each device maps every
+ * (type, code) it can send to one of these when it is probed, so an
+ * event needs a single table lookup instead of switches on type and
+ * code. */
+enum evdev_op {
+	EVDEV_OP_NONE,
+	EVDEV_OP_KEY,
+	/* Caps, Num and Scroll Lock also flip the LED state */
+	EVDEV_OP_KEY_LED,
+	EVDEV_OP_BUTTON,
+	/* BTN_TOUCH of a single touch device */
+	EVDEV_OP_TOUCH,
+	EVDEV_OP_REL_X,
+	EVDEV_OP_REL_Y,
+	EVDEV_OP_WHEEL,
+	EVDEV_OP_HWHEEL,
+	EVDEV_OP_ABS_X,
+	EVDEV_OP_ABS_Y,
+	EVDEV_OP_MT_SLOT,
+	EVDEV_OP_MT_TRACKING_ID,
+	EVDEV_OP_MT_POSITION_X,
+	EVDEV_OP_MT_POSITION_Y,
+	EVDEV_OP_SYN_REPORT,
+};
+
+/* Layout of the per-device op table, indexed by type offset + code */
+#define EVDEV_OPS_SYN 0
+#define EVDEV_OPS_KEY (EVDEV_OPS_SYN + SYN_CNT)
+#define EVDEV_OPS_REL (EVDEV_OPS_KEY + KEY_CNT)
+#define EVDEV_OPS_ABS (EVDEV_OPS_REL + REL_CNT)
+#define EVDEV_OPS_SIZE (EVDEV_OPS_ABS + ABS_CNT)
+
+/* copied from udev/extras/input_id/input_id.c */
+/* we must use this kernel-compatible implementation */
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define NBITS(x) ((((x)-1)/BITS_PER_LONG)+1)
+#define OFF(x)  ((x)%BITS_PER_LONG)
+#define BIT(x)  (1UL<<OFF(x))
+#define LONG(x) ((x)/BITS_PER_LONG)
+#define TEST_BIT(array, bit)    ((array[LONG(bit)] >> OFF(bit)) & 1)
+/* end copied */
+#define SET_BIT(array, bit)     ((array)[LONG(bit)] |= BIT(bit))
+#define CLEAR_BIT(array, bit)   ((array)[LONG(bit)] &= ~BIT(bit))
+
+/* Everything probed from the kernel that the dispatch depends on. It is
+ * stored verbatim in recordings, so the layout is that of the host. */
+struct evdev_caps {
+	char name[256];
+	struct input_id id;
+	unsigned long props[NBITS(INPUT_PROP_CNT)];
+	unsigned long ev[NBITS(EV_CNT)];
+	unsigned long key[NBITS(KEY_CNT)];
+	unsigned long rel[NBITS(REL_CNT)];
+	unsigned long abs[NBITS(ABS_CNT)];
+	unsigned long led[NBITS(LED_CNT)];
+	struct input_absinfo absinfo[ABS_CNT];
+};
+
+/* Event codes the dispatch consumes. Once installed with EVIOCSMASK the
+ * kernel drops everything else before it is copied to us. */
+struct evdev_event_mask {
+	int enabled;
+	unsigned long key[NBITS(KEY_CNT)];
+	unsigned long rel[NBITS(REL_CNT)];
+	unsigned long abs[NBITS(ABS_CNT)];
+	unsigned long msc[NBITS(MSC_CNT)];
+	unsigned long sw[NBITS(SW_CNT)];
+};
+
 enum evdev_event_type {
 	EVDEV_ABSOLUTE_MOTION = (1 << 0),
-	EVDEV_ABSOLUTE_MT_DOWN = (1 << 1),
-	EVDEV_ABSOLUTE_MT_MOTION = (1 << 2),
-	EVDEV_ABSOLUTE_MT_UP = (1 << 3),
 	EVDEV_RELATIVE_MOTION = (1 << 4),
-	EVDEV_SYN = (1 << 5),
+};
+
+/* Autorepeat of the key last pressed on a seat. Deadlines are in the
+ * event clock, which is CLOCK_MONOTONIC for devices the library reads. */
+struct evdev_key_repeat {
+	/* Nanoseconds, period is 0 while repeat is off */
+	uint64_t delay;
+	uint64_t period;
+
+	/* Device and key repeating, device is NULL when none is */
+	struct evdev_device *device;
+	uint32_t key;
+	uint64_t deadline;
+	struct yt_timer timer;
 };
 
 struct evdev_device {
@@ -44,7 +135,33 @@ struct evdev_device {
 	void *user_data;
 
 	struct yt_seat *seat;
+	struct yt_source *source;
+	struct yt_uring_req *uring_req;
+	struct yt_recorder *recorder;
+	/* Set for devices fed through yt_fake_device_write() */
+	struct yt_fake *fake;
 	struct evdev_dispatch *dispatch;
+	uint8_t ops[EVDEV_OPS_SIZE];
+
+	/* Applied to relative motion at flush time, NULL when off */
+	struct motion_filter *accel;
+	/* Set by touchpads, whose velocities scale with their size */
+	double accel_diagonal;
+
+	/* The seat's callbacks and timers, cached when the device joins it */
+	struct yt_seat_notify_interface *notify;
+	void *notify_data;
+	struct yt_timer_wheel *timers;
+	struct evdev_key_repeat *repeat;
+	/* Keymap and modifier state, NULL when built without xkbcommon */
+	struct yt_xkb *xkb;
+	/* Deadline of the dispatch, cancelled when the device leaves */
+	struct yt_timer timer;
+
+	/* Capabilities probed when the device was created */
+	struct evdev_caps caps;
+	struct evdev_event_mask mask;
+
 	struct {
 		int min_x, max_x, min_y, max_y;
 		int32_t x, y;
@@ -55,8 +172,16 @@ struct evdev_device {
 
 	struct {
 		int slot;
+		int has_slots;
 		int32_t x[MAX_SLOTS];
 		int32_t y[MAX_SLOTS];
+		/* Per-slot bitmasks: contacts currently down, and slots that
+		 * went down, moved or went up since the last SYN_REPORT. */
+		uint32_t active;
+		uint32_t down;
+		uint32_t motion;
+		uint32_t up;
+		int32_t tracking_id[MAX_SLOTS];
 	} mt;
 	struct mtdev *mtdev;
 
@@ -64,31 +189,58 @@ struct evdev_device {
 		wl_fixed_t dx, dy;
 	} rel;
 
+	struct {
+		struct input_event *ev;
+		unsigned int size;
+		unsigned int peak;
+	} buffer;
+
+	struct {
+		struct yt_event ev[EVDEV_FRAME_MAX];
+		int count;
+	} frame;
+
+	/* Last known key and (non-MT) axis state, used to resync after the
+	 * kernel dropped events. */
+	struct {
+		int dropped;
+		unsigned long key[NBITS(KEY_CNT)];
+		int32_t abs[ABS_MT_SLOT];
+	} sync;
+
+	/* Nanosecond timestamp and keysym of the event being delivered */
+	uint64_t time_ns;
+	uint32_t keysym;
+	struct yt_latency latency;
+
+	struct yt_device_stats stats;
+	/* Motion samples taken, at most one per frame and axis pair or
+	 * touch, and motion notifications sent, from which
+	 * stats.motion_coalesced is derived */
+	uint64_t motion_samples;
+	uint64_t motion_notified;
+
 	enum evdev_event_type pending_events;
 	int is_mt;
 	enum yt_led_state led_state;
 };
 
-/* copied from udev/extras/input_id/input_id.c */
-/* we must use this kernel-compatible implementation */
-#define BITS_PER_LONG (sizeof(unsigned long) * 8)
-#define NBITS(x) ((((x)-1)/BITS_PER_LONG)+1)
-#define OFF(x)  ((x)%BITS_PER_LONG)
-#define BIT(x)  (1UL<<OFF(x))
-#define LONG(x) ((x)/BITS_PER_LONG)
-#define TEST_BIT(array, bit)    ((array[LONG(bit)] >> OFF(bit)) & 1)
-/* end copied */
 
 struct evdev_dispatch;
 
 struct evdev_dispatch_interface {
-	/* Process an evdev input event. */
+	/* Process an evdev input event, time is in nanoseconds. */
 	void (*process) (struct evdev_dispatch * dispatch,
 			struct evdev_device * device,
-			struct input_event * event, uint time);
+			struct input_event * event, uint64_t time);
 
 	/* Destroy an event dispatch handler and free all its resources. */
 	void (*destroy) (struct evdev_dispatch * dispatch);
+
+	/* Fill in the event codes process() makes use of. */
+	void (*event_mask) (struct evdev_dispatch * dispatch,
+			struct evdev_device * device,
+			struct evdev_event_mask * mask);
 };
 
 struct evdev_dispatch {
@@ -99,7 +251,34 @@ struct evdev_dispatch *evdev_touchpad_create(struct evdev_device *device);
 
 void evdev_led_update(struct evdev_device *device, enum yt_led_state state);
 
+void evdev_frame_append(struct evdev_device *device, const struct yt_event *event);
+void evdev_frame_flush(struct evdev_device *device);
+void evdev_notify_event(struct evdev_device *device, const struct yt_event *event);
+void evdev_notify_frame(struct evdev_device *device);
+void evdev_notify_motion(struct evdev_device *device, uint64_t time,
+		wl_fixed_t dx, wl_fixed_t dy);
+void evdev_notify_motion_absolute(struct evdev_device *device, uint64_t time,
+		wl_fixed_t x, wl_fixed_t y);
+void evdev_notify_button(struct evdev_device *device, uint64_t time,
+		int32_t button, enum yt_button_state state);
+void evdev_notify_axis(struct evdev_device *device, uint64_t time,
+		enum yt_axis_type axis, wl_fixed_t value);
+void evdev_notify_key(struct evdev_device *device, uint64_t time,
+		uint32_t key, enum yt_key_state state, uint32_t keysym);
+void evdev_notify_modifiers(struct evdev_device *device, uint64_t time,
+		const struct yt_modifiers *modifiers);
+void evdev_notify_touch(struct evdev_device *device, uint64_t time,
+		int touch_id, wl_fixed_t x, wl_fixed_t y, enum yt_touch_state state);
+void evdev_notify_touch_frame(struct evdev_device *device, uint64_t time);
+
 struct evdev_device *evdev_device_create(const char *path);
+int evdev_device_accel_set(struct evdev_device *device,
+		enum yt_accel_profile profile, double speed);
+void evdev_device_set_seat(struct evdev_device *device, struct yt_seat *seat);
+void evdev_key_repeat_init(struct evdev_key_repeat *repeat);
+void evdev_key_repeat_stop(struct evdev_key_repeat *repeat);
+struct evdev_device *evdev_device_create_from_caps(const struct evdev_caps *caps,
+		const char *path);
 
 void evdev_device_destroy(struct evdev_device *device);
 
@@ -107,8 +286,15 @@ void evdev_device_destroy(struct evdev_device *device);
 //evdev_notify_keyboard_focus(struct weston_seat *seat,
 //                          struct wl_list *evdev_devices);
 
+void evdev_device_setup_fd(struct evdev_device *device);
+int evdev_device_install_mask(struct evdev_device *device);
 int evdev_device_data(int fd, uint32_t mask, void *data);
-int touchpad_timeout_handler(struct evdev_device *device);
+void evdev_process_events(struct evdev_device *device,
+		struct input_event *ev, int count);
+void evdev_device_input(struct evdev_device *device,
+		struct input_event *ev, int count);
+int touchpad_motion_configure(struct evdev_device *device,
+		unsigned int history_length, unsigned int smoothing);
 
 static inline struct evdev_device *evdev_device(struct yt_device *device)
 {
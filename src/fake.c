@@ -0,0 +1,160 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "fake.h"
+#include "common.h"
+
+/* The device reads from one end of a pipe, the caller writes events into
+ * the other. A pipe keeps the read() semantics of an evdev node: whatever
+ * is queued comes out at once, and a short read means it is drained. */
+struct yt_fake {
+	int read_fd;
+	int write_fd;
+};
+
+static void fake_caps_fill(struct evdev_caps *caps, const struct yt_fake_desc *desc)
+{
+	int i;
+
+	memset(caps, 0, sizeof *caps);
+	snprintf(caps->name, sizeof caps->name, "%s",
+			desc->name ? desc->name : "fake device");
+	caps->id.bustype = BUS_VIRTUAL;
+	caps->id.vendor = desc->vendor;
+	caps->id.product = desc->product;
+
+	SET_BIT(caps->ev, EV_SYN);
+	for (i = 0; i < desc->nprops; i++)
+		if (desc->props[i] < INPUT_PROP_CNT)
+			SET_BIT(caps->props, desc->props[i]);
+	for (i = 0; i < desc->nkeys; i++) {
+		if (desc->keys[i] >= KEY_CNT)
+			continue;
+		SET_BIT(caps->ev, EV_KEY);
+		SET_BIT(caps->key, desc->keys[i]);
+	}
+	for (i = 0; i < desc->nrels; i++) {
+		if (desc->rels[i] >= REL_CNT)
+			continue;
+		SET_BIT(caps->ev, EV_REL);
+		SET_BIT(caps->rel, desc->rels[i]);
+	}
+	for (i = 0; i < desc->naxes; i++) {
+		if (desc->axes[i].code >= ABS_CNT)
+			continue;
+		SET_BIT(caps->ev, EV_ABS);
+		SET_BIT(caps->abs, desc->axes[i].code);
+		caps->absinfo[desc->axes[i].code].minimum = desc->axes[i].minimum;
+		caps->absinfo[desc->axes[i].code].maximum = desc->axes[i].maximum;
+	}
+}
+
+struct evdev_device *fake_device_create(const struct yt_fake_desc *desc)
+{
+	struct evdev_device *device;
+	struct evdev_caps *caps;
+	struct yt_fake *fake;
+	int fds[2];
+
+	fake = malloc(sizeof *fake);
+	caps = malloc(sizeof *caps);
+	if (fake == NULL || caps == NULL)
+		goto err_free;
+
+	if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0)
+		goto err_free;
+	fake->read_fd = fds[0];
+	fake->write_fd = fds[1];
+
+	fake_caps_fill(caps, desc);
+	device = evdev_device_create_from_caps(caps, "fake");
+	free(caps);
+	if (device == NULL) {
+		close(fake->read_fd);
+		close(fake->write_fd);
+		free(fake);
+		return NULL;
+	}
+	device->fake = fake;
+
+	return device;
+
+err_free:
+	free(caps);
+	free(fake);
+	return NULL;
+}
+
+/* Stands in for open() of the device node in yt_device_add_to_seat() */
+int fake_device_open(struct evdev_device *device)
+{
+	return fcntl(device->fake->read_fd, F_DUPFD_CLOEXEC, 0);
+}
+
+/* Like write(): returns the number of events queued, or -1 with errno
+ * set to EAGAIN if the pipe is full. Writes up to PIPE_BUF are atomic, so
+ * events go in chunks of that size and never arrive split. */
+int fake_device_write(struct evdev_device *device,
+		const struct input_event *ev, int count)
+{
+	const int chunk = PIPE_BUF / sizeof *ev;
+	ssize_t len;
+	int done = 0, n;
+
+	if (device->fake == NULL || count < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (done < count) {
+		n = count - done < chunk ? count - done : chunk;
+		len = write(device->fake->write_fd, ev + done, n * sizeof *ev);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return done ? done : -1;
+		}
+		done += len / sizeof *ev;
+	}
+
+	return done;
+}
+
+void fake_device_destroy(struct evdev_device *device)
+{
+	struct yt_fake *fake = device->fake;
+
+	evdev_device_destroy(device);
+	if (fake) {
+		close(fake->read_fd);
+		close(fake->write_fd);
+		free(fake);
+	}
+}
@@ -0,0 +1,15 @@
+#ifndef YT_FAKE_H
+#define YT_FAKE_H
+
+#include "yutani.h"
+#include "evdev.h"
+
+struct yt_fake;
+
+struct evdev_device *fake_device_create(const struct yt_fake_desc *desc);
+int fake_device_open(struct evdev_device *device);
+int fake_device_write(struct evdev_device *device,
+		const struct input_event *ev, int count);
+void fake_device_destroy(struct evdev_device *device);
+
+#endif /* YT_FAKE_H */
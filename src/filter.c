@@ -0,0 +1,177 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <wayland-util.h>
+
+#include "filter.h"
+
+/* Motion within this window makes up the velocity estimate. At 1000 Hz
+ * the ring covers the last 8 ms, which is plenty to smooth over. */
+#define ACCEL_TRACKERS 8
+#define ACCEL_WINDOW_NS (40 * 1000000ULL)
+
+/* Velocities are 24.8 fixed point units/ms like wl_fixed_t; the table
+ * has an entry every 0.5 units/ms and is interpolated in between. */
+#define ACCEL_LUT_SHIFT 7
+#define ACCEL_LUT_SIZE 256
+
+struct pointer_tracker {
+	/* Length of the motion, 24.8 */
+	int64_t length;
+	uint64_t time;
+};
+
+struct pointer_accelerator {
+	struct motion_filter base;
+
+	struct pointer_tracker trackers[ACCEL_TRACKERS];
+	unsigned int cur;
+
+	/* Factors in 16.16 fixed point */
+	int32_t lut[ACCEL_LUT_SIZE + 1];
+};
+
+/* max + 3/8 min, within 7% of the real length */
+static inline int64_t approx_length(wl_fixed_t dx, wl_fixed_t dy)
+{
+	int64_t a = llabs(dx), b = llabs(dy);
+
+	return a > b ? a + (3 * b >> 3) : b + (3 * a >> 3);
+}
+
+/* Distance covered by the motions since the oldest tracker still inside
+ * the window, over the time since then. The motion of that oldest
+ * tracker happened before it and is not part of the estimate. */
+static int64_t accelerator_velocity(struct pointer_accelerator *accel,
+		uint64_t time)
+{
+	struct pointer_tracker *tracker, *newer;
+	int64_t distance = 0;
+	uint64_t start = time;
+	unsigned int i;
+
+	newer = &accel->trackers[accel->cur];
+	for (i = 1; i < ACCEL_TRACKERS; i++) {
+		tracker = &accel->trackers[(accel->cur - i) % ACCEL_TRACKERS];
+		if (tracker->time == 0 || tracker->time > newer->time ||
+				time - tracker->time > ACCEL_WINDOW_NS)
+			break;
+
+		distance += newer->length;
+		start = tracker->time;
+		newer = tracker;
+	}
+
+	if (start == time)
+		return 0;
+
+	return distance * 1000000 / (int64_t)(time - start);
+}
+
+static int32_t accelerator_factor(struct pointer_accelerator *accel,
+		int64_t velocity)
+{
+	int64_t index = velocity >> ACCEL_LUT_SHIFT;
+	int32_t frac, lo, hi;
+
+	if (index >= ACCEL_LUT_SIZE)
+		return accel->lut[ACCEL_LUT_SIZE];
+
+	frac = velocity & ((1 << ACCEL_LUT_SHIFT) - 1);
+	lo = accel->lut[index];
+	hi = accel->lut[index + 1];
+	return lo + (int32_t)(((int64_t)(hi - lo) * frac) >> ACCEL_LUT_SHIFT);
+}
+
+/* Scales by a 16.16 factor, rounding halves away from zero so that
+ * motion in either direction is treated alike. */
+static inline wl_fixed_t accelerator_scale(wl_fixed_t v, int32_t factor)
+{
+	int64_t p = (int64_t)v * factor;
+
+	if (p < 0)
+		return -(wl_fixed_t)((-p + 0x8000) >> 16);
+	return (p + 0x8000) >> 16;
+}
+
+static void accelerator_filter(struct motion_filter *filter,
+		wl_fixed_t *dx, wl_fixed_t *dy, uint64_t time)
+{
+	struct pointer_accelerator *accel = (struct pointer_accelerator *)filter;
+	struct pointer_tracker *tracker;
+	int32_t factor;
+
+	accel->cur = (accel->cur + 1) % ACCEL_TRACKERS;
+	tracker = &accel->trackers[accel->cur];
+	tracker->length = approx_length(*dx, *dy);
+	tracker->time = time;
+
+	factor = accelerator_factor(accel, accelerator_velocity(accel, time));
+
+	*dx = accelerator_scale(*dx, factor);
+	*dy = accelerator_scale(*dy, factor);
+}
+
+static void accelerator_destroy(struct motion_filter *filter)
+{
+	free(filter);
+}
+
+static const struct motion_filter_interface accelerator_interface = {
+	accelerator_filter,
+	accelerator_destroy
+};
+
+struct motion_filter *create_pointer_accelerator_filter(accel_profile_func_t profile,
+		void *data)
+{
+	struct pointer_accelerator *accel;
+	double velocity;
+	int i;
+
+	accel = calloc(1, sizeof *accel);
+	if (accel == NULL)
+		return NULL;
+
+	accel->base.interface = &accelerator_interface;
+
+	for (i = 0; i <= ACCEL_LUT_SIZE; i++) {
+		velocity = (double)(i << ACCEL_LUT_SHIFT) / 256.0;
+		accel->lut[i] = profile(data, velocity) * 65536.0 + 0.5;
+	}
+
+	return &accel->base;
+}
+
+double accel_profile_linear(void *data, double velocity)
+{
+	struct accel_linear *params = data;
+	double factor = params->offset + velocity * params->slope;
+
+	if (factor > params->max)
+		factor = params->max;
+	if (factor < params->min)
+		factor = params->min;
+
+	return factor;
+}
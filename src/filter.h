@@ -0,0 +1,72 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef YT_FILTER_H
+#define YT_FILTER_H
+
+#include <stdint.h>
+#include <wayland-util.h>
+
+/* A stage that rewrites relative motion before it is notified. It runs
+ * once per frame and must not allocate. */
+struct motion_filter;
+
+struct motion_filter_interface {
+	void (*filter)(struct motion_filter *filter,
+			wl_fixed_t *dx, wl_fixed_t *dy, uint64_t time);
+	void (*destroy)(struct motion_filter *filter);
+};
+
+struct motion_filter {
+	const struct motion_filter_interface *interface;
+};
+
+static inline void filter_dispatch(struct motion_filter *filter,
+		wl_fixed_t *dx, wl_fixed_t *dy, uint64_t time)
+{
+	filter->interface->filter(filter, dx, dy, time);
+}
+
+static inline void filter_destroy(struct motion_filter *filter)
+{
+	if (filter)
+		filter->interface->destroy(filter);
+}
+
+/* Maps a velocity in device units per millisecond to an acceleration
+ * factor. Only called while the filter is created, to fill its lookup
+ * table. */
+typedef double (*accel_profile_func_t)(void *data, double velocity);
+
+struct motion_filter *create_pointer_accelerator_filter(accel_profile_func_t profile,
+		void *data);
+
+/* factor = offset + velocity * slope, clamped to [min, max] */
+struct accel_linear {
+	double min;
+	double max;
+	double offset;
+	double slope;
+};
+
+double accel_profile_linear(void *data, double velocity);
+
+#endif /* YT_FILTER_H */
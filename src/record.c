@@ -0,0 +1,141 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "record.h"
+
+struct yt_recorder {
+	int fd;
+	size_t used;
+	char buf[YT_RECORD_BUFFER_SIZE];
+};
+
+static int yt_recorder_write_all(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(fd, p, size);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+static void yt_recorder_flush(struct yt_recorder *recorder)
+{
+	if (recorder->fd < 0 || recorder->used == 0)
+		return;
+
+	/* On failure the recording stops, input goes on as usual */
+	if (yt_recorder_write_all(recorder->fd, recorder->buf, recorder->used) < 0) {
+		fprintf(stderr, "recording failed, stopped: %m\n");
+		close(recorder->fd);
+		recorder->fd = -1;
+	}
+	recorder->used = 0;
+}
+
+struct yt_recorder *yt_recorder_create(const char *path,
+		const struct evdev_caps *caps, uint32_t flags)
+{
+	struct yt_recorder *recorder;
+	struct yt_record_header header;
+
+	recorder = malloc(sizeof *recorder);
+	if (recorder == NULL)
+		return NULL;
+
+	recorder->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (recorder->fd < 0) {
+		fprintf(stderr, "failed to create recording %s: %m\n", path);
+		free(recorder);
+		return NULL;
+	}
+	recorder->used = 0;
+
+	memset(&header, 0, sizeof header);
+	header.magic = YT_RECORD_MAGIC;
+	header.version = YT_RECORD_VERSION;
+	header.header_size = sizeof header;
+	header.event_size = sizeof(struct input_event);
+	header.caps_size = sizeof header.caps;
+	header.flags = flags;
+	header.caps = *caps;
+
+	if (yt_recorder_write_all(recorder->fd, &header, sizeof header) < 0) {
+		fprintf(stderr, "failed to write recording %s: %m\n", path);
+		close(recorder->fd);
+		free(recorder);
+		return NULL;
+	}
+
+	return recorder;
+}
+
+/* Events are only copied here; the file sees one write per full block. */
+void yt_recorder_write(struct yt_recorder *recorder,
+		const struct input_event *ev, int count)
+{
+	size_t size = count * sizeof *ev;
+
+	if (recorder->fd < 0 || count <= 0)
+		return;
+
+	if (recorder->used + size > sizeof recorder->buf)
+		yt_recorder_flush(recorder);
+
+	if (size > sizeof recorder->buf) {
+		if (yt_recorder_write_all(recorder->fd, ev, size) < 0) {
+			fprintf(stderr, "recording failed, stopped: %m\n");
+			close(recorder->fd);
+			recorder->fd = -1;
+		}
+		return;
+	}
+
+	memcpy(recorder->buf + recorder->used, ev, size);
+	recorder->used += size;
+}
+
+void yt_recorder_destroy(struct yt_recorder *recorder)
+{
+	if (recorder == NULL)
+		return;
+
+	yt_recorder_flush(recorder);
+	if (!(recorder->fd < 0))
+		close(recorder->fd);
+	free(recorder);
+}
@@ -0,0 +1,41 @@
+#ifndef YT_RECORD_H
+#define YT_RECORD_H
+
+#include <stdint.h>
+#include <linux/input.h>
+#include "evdev.h"
+
+/* A recording is this header followed by the raw struct input_event
+ * stream of one device, exactly as read from it. Both are written in the
+ * host's layout, so a file can be mmap()ed and walked in place. */
+#define YT_RECORD_MAGIC 0x43455459 /* "YTEC" */
+#define YT_RECORD_VERSION 1
+
+/* Written in blocks of this size */
+#define YT_RECORD_BUFFER_SIZE (64 * 1024)
+
+enum yt_record_flags {
+	/* The stream is mtdev output: protocol B, whatever the caps say */
+	YT_RECORD_MTDEV = (1 << 0),
+};
+
+struct yt_record_header {
+	uint32_t magic;
+	uint32_t version;
+	/* Offset of the first event */
+	uint32_t header_size;
+	uint32_t event_size;
+	uint32_t caps_size;
+	uint32_t flags;
+	struct evdev_caps caps;
+};
+
+struct yt_recorder;
+
+struct yt_recorder *yt_recorder_create(const char *path,
+		const struct evdev_caps *caps, uint32_t flags);
+void yt_recorder_write(struct yt_recorder *recorder,
+		const struct input_event *ev, int count);
+void yt_recorder_destroy(struct yt_recorder *recorder);
+
+#endif /* YT_RECORD_H */
@@ -0,0 +1,245 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "replay.h"
+#include "record.h"
+#include "common.h"
+#include "timer.h"
+#include "thread.h"
+
+/* Timers still pending after the last event run as if the device had
+ * then stayed quiet this long, so that e.g. a final tap is reported. */
+#define YT_REPLAY_TAIL_NS 1000000000ULL
+
+struct yt_replay {
+	struct evdev_device *device;
+	/* The device's timers, on the clock of the recording */
+	struct yt_timer_wheel *timers;
+	void *map;
+	size_t size;
+	struct input_event *events;
+	size_t count;
+
+	/* When the run started, and the recorded time it maps to */
+	uint64_t start;
+	uint64_t base;
+};
+
+static uint64_t replay_event_time(const struct input_event *e)
+{
+	return (uint64_t)e->time.tv_sec * 1000000000 + e->time.tv_usec * 1000;
+}
+
+/* Joining or leaving a seat touches its key repeat, which an input
+ * thread may be running. */
+static void replay_set_seat(struct yt_replay *replay, struct yt_seat *seat)
+{
+	struct yt_seat *locked = seat ? seat : replay->device->seat;
+	struct yt_thread *thread = locked ? yt_seat_thread_get(locked) : NULL;
+
+	if (thread)
+		yt_thread_lock(thread);
+	evdev_device_set_seat(replay->device, seat);
+	if (thread)
+		yt_thread_unlock(thread);
+}
+
+struct yt_replay *replay_open(const char *path, struct yt_seat *seat)
+{
+	struct yt_replay *replay;
+	struct yt_record_header *header;
+	struct stat st;
+	int fd;
+
+	/* Events are handed out on the caller's thread */
+	if (yt_seat_thread_get(seat))
+		return NULL;
+
+	replay = calloc(1, sizeof *replay);
+	if (replay == NULL)
+		return NULL;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open recording %s: %m\n", path);
+		goto err_free;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof *header) {
+		fprintf(stderr, "%s: not a recording\n", path);
+		goto err_close;
+	}
+
+	/* Private and writable, as the dispatch takes non-const events */
+	replay->size = st.st_size;
+	replay->map = mmap(NULL, replay->size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+	if (replay->map == MAP_FAILED) {
+		fprintf(stderr, "failed to map recording %s: %m\n", path);
+		goto err_close;
+	}
+	close(fd);
+
+	header = replay->map;
+	if (header->magic != YT_RECORD_MAGIC ||
+			header->version != YT_RECORD_VERSION ||
+			header->event_size != sizeof(struct input_event) ||
+			header->caps_size != sizeof header->caps ||
+			header->header_size < sizeof *header ||
+			header->header_size > replay->size) {
+		fprintf(stderr, "%s: unsupported recording\n", path);
+		goto err_unmap;
+	}
+
+	replay->events = (struct input_event *)
+		((char *)replay->map + header->header_size);
+	replay->count = (replay->size - header->header_size) /
+		sizeof(struct input_event);
+
+	replay->timers = yt_timer_wheel_create_virtual(replay->count ?
+			replay_event_time(&replay->events[0]) : 0);
+	if (!replay->timers)
+		goto err_unmap;
+
+	replay->device = evdev_device_create_from_caps(&header->caps, path);
+	if (!replay->device)
+		goto err_timers;
+	replay_set_seat(replay, seat);
+	/* Timeouts must not depend on how fast or how smoothly the replay
+	 * runs, so they go by the recorded timestamps, not the seat's
+	 * timerfd. */
+	replay->device->timers = replay->timers;
+
+	return replay;
+
+err_timers:
+	yt_timer_wheel_destroy(replay->timers);
+err_unmap:
+	munmap(replay->map, replay->size);
+	goto err_free;
+err_close:
+	close(fd);
+err_free:
+	free(replay);
+	return NULL;
+}
+
+static uint64_t replay_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Sleep until the moment the recorded time maps to */
+static void replay_sleep(struct yt_replay *replay, uint64_t time)
+{
+	uint64_t due;
+	struct timespec ts;
+
+	if (time <= replay->base)
+		return;
+
+	due = replay->start + (time - replay->base);
+	ts.tv_sec = due / 1000000000;
+	ts.tv_nsec = due % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/* Expire the timers due by the recorded time, each at its own deadline
+ * as the timerfd would have, and move their clock there. */
+static void replay_timers_run(struct yt_replay *replay, uint64_t time,
+		enum yt_replay_mode mode)
+{
+	uint64_t next;
+
+	while ((next = yt_timer_wheel_next(replay->timers)) <= time) {
+		if (mode == YT_REPLAY_REALTIME)
+			replay_sleep(replay, next);
+		yt_timer_wheel_run(replay->timers, next);
+	}
+	yt_timer_wheel_run(replay->timers, time);
+}
+
+/* Feed the recording through the dispatch one frame at a time, either
+ * spaced as recorded or back to back. Timeouts run on the recorded
+ * clock in both modes, so a recording always produces the same events.
+ * Returns the number of events. */
+int replay_run(struct yt_replay *replay, enum yt_replay_mode mode)
+{
+	struct input_event *events = replay->events;
+	uint64_t time = 0;
+	size_t i, n;
+
+	if (replay->count == 0)
+		return 0;
+
+	replay->start = replay_now();
+	replay->base = replay_event_time(&events[0]);
+
+	for (i = 0; i < replay->count; i += n) {
+		for (n = 1; i + n < replay->count; n++)
+			if (events[i + n - 1].type == EV_SYN &&
+					events[i + n - 1].code == SYN_REPORT)
+				break;
+
+		time = replay_event_time(&events[i]);
+		replay_timers_run(replay, time, mode);
+		if (mode == YT_REPLAY_REALTIME)
+			replay_sleep(replay, time);
+
+		evdev_process_events(replay->device, &events[i], n);
+	}
+
+	replay_timers_run(replay, time + YT_REPLAY_TAIL_NS, mode);
+
+	return replay->count;
+}
+
+struct yt_device *replay_device_get(struct yt_replay *replay)
+{
+	return &replay->device->base;
+}
+
+void replay_close(struct yt_replay *replay)
+{
+	if (replay == NULL)
+		return;
+
+	/* It never joined the seat's device list */
+	replay_set_seat(replay, NULL);
+	evdev_device_destroy(replay->device);
+	yt_timer_wheel_destroy(replay->timers);
+	munmap(replay->map, replay->size);
+	free(replay);
+}
@@ -0,0 +1,12 @@
+#ifndef YT_REPLAY_H
+#define YT_REPLAY_H
+
+#include "yutani.h"
+#include "evdev.h"
+
+struct yt_replay *replay_open(const char *path, struct yt_seat *seat);
+int replay_run(struct yt_replay *replay, enum yt_replay_mode mode);
+struct yt_device *replay_device_get(struct yt_replay *replay);
+void replay_close(struct yt_replay *replay);
+
+#endif /* YT_REPLAY_H */
@@ -0,0 +1,393 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "thread.h"
+
+#define YT_THREAD_QUEUE_DEFAULT 1024
+#define YT_THREAD_DISPATCH_MAX 32
+
+struct yt_thread_entry {
+	/* NULL once the device left the seat */
+	struct evdev_device *device;
+	/* Set for the SYN_REPORT marker closing a frame */
+	int frame_end;
+	struct yt_event event;
+};
+
+struct yt_thread {
+	pthread_t thread;
+	/* Held by the input thread while it dispatches, and by the
+	 * compositor thread while it changes the thread's sources. */
+	pthread_mutex_t mutex;
+	int priority;
+	uint64_t cpu_mask;
+
+	int epoll_fd;
+	int stop_fd;
+	/* Wakes the compositor when events were queued */
+	int event_fd;
+	/* Wakes the input thread when the compositor made room */
+	int space_fd;
+	atomic_int waiting;
+	atomic_int running;
+	int pushed;
+
+	/* Single producer (input thread), single consumer (compositor) */
+	struct yt_thread_entry *entries;
+	unsigned int mask;
+	atomic_uint head;
+	atomic_uint tail;
+
+	/* Sources removed while the input thread may still hold them */
+	struct wl_list destroy_list;
+};
+
+static void yt_thread_wake(int fd)
+{
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof one) < 0 && errno != EAGAIN)
+		fprintf(stderr, "failed to wake input thread peer: %m\n");
+}
+
+struct yt_thread *yt_thread_create(const struct yt_seat_thread_config *config)
+{
+	struct yt_thread *thread;
+	struct epoll_event ev;
+	unsigned int size = YT_THREAD_QUEUE_DEFAULT;
+
+	if (config && config->queue_size) {
+		size = 1;
+		while (size < config->queue_size)
+			size <<= 1;
+	}
+
+	thread = calloc(1, sizeof *thread);
+	if (thread == NULL)
+		return NULL;
+
+	thread->entries = calloc(size, sizeof *thread->entries);
+	if (thread->entries == NULL)
+		goto err_free;
+	thread->mask = size - 1;
+	if (config) {
+		thread->priority = config->priority;
+		thread->cpu_mask = config->cpu_mask;
+	}
+
+	thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	thread->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	thread->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	/* The input thread blocks on this one when the queue is full */
+	thread->space_fd = eventfd(0, EFD_CLOEXEC);
+	if (thread->epoll_fd < 0 || thread->stop_fd < 0 ||
+			thread->event_fd < 0 || thread->space_fd < 0)
+		goto err_close;
+
+	/* A NULL source tells the thread to exit */
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, thread->stop_fd, &ev) < 0)
+		goto err_close;
+
+	pthread_mutex_init(&thread->mutex, NULL);
+	wl_list_init(&thread->destroy_list);
+	atomic_init(&thread->head, 0);
+	atomic_init(&thread->tail, 0);
+	atomic_init(&thread->waiting, 0);
+	atomic_init(&thread->running, 0);
+
+	return thread;
+
+err_close:
+	if (thread->epoll_fd >= 0)
+		close(thread->epoll_fd);
+	if (thread->stop_fd >= 0)
+		close(thread->stop_fd);
+	if (thread->event_fd >= 0)
+		close(thread->event_fd);
+	if (thread->space_fd >= 0)
+		close(thread->space_fd);
+	free(thread->entries);
+err_free:
+	free(thread);
+	return NULL;
+}
+
+static void *yt_thread_main(void *data)
+{
+	struct yt_thread *thread = data;
+	struct epoll_event ep[YT_THREAD_DISPATCH_MAX];
+	struct yt_source *source, *next;
+	int count, i, priority, stop = 0;
+
+	while (!stop) {
+		count = epoll_wait(thread->epoll_fd, ep, ARRAY_LENGTH(ep), -1);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "input thread epoll_wait failed: %m\n");
+			break;
+		}
+
+		pthread_mutex_lock(&thread->mutex);
+		for (priority = 0; priority < YT_SOURCE_PRIORITY_COUNT; priority++) {
+			for (i = 0; i < count; i++) {
+				source = ep[i].data.ptr;
+				if (source == NULL) {
+					stop = 1;
+					continue;
+				}
+				if (source->priority != (enum yt_source_priority)priority ||
+						source->fd < 0)
+					continue;
+				source->func(source->fd, ep[i].events, source->data);
+			}
+		}
+
+		wl_list_for_each_safe(source, next, &thread->destroy_list, link)
+			free(source);
+		wl_list_init(&thread->destroy_list);
+		pthread_mutex_unlock(&thread->mutex);
+
+		/* One wakeup per batch of reads, not per event */
+		if (thread->pushed) {
+			thread->pushed = 0;
+			yt_thread_wake(thread->event_fd);
+		}
+	}
+
+	atomic_store(&thread->running, 0);
+	yt_thread_wake(thread->event_fd);
+
+	return NULL;
+}
+
+int yt_thread_start(struct yt_thread *thread)
+{
+	struct sched_param param;
+	cpu_set_t cpus;
+	int i, ret;
+
+	atomic_store(&thread->running, 1);
+	ret = pthread_create(&thread->thread, NULL, yt_thread_main, thread);
+	if (ret != 0) {
+		atomic_store(&thread->running, 0);
+		fprintf(stderr, "failed to create input thread: %s\n", strerror(ret));
+		return -1;
+	}
+	pthread_setname_np(thread->thread, "yt-input");
+
+	/* Both need privileges we may not have; run without them then. */
+	if (thread->priority > 0) {
+		memset(&param, 0, sizeof param);
+		param.sched_priority = thread->priority;
+		ret = pthread_setschedparam(thread->thread, SCHED_FIFO, &param);
+		if (ret != 0)
+			fprintf(stderr, "failed to set input thread priority: %s\n",
+					strerror(ret));
+	}
+
+	if (thread->cpu_mask) {
+		CPU_ZERO(&cpus);
+		for (i = 0; i < 64 && i < CPU_SETSIZE; i++)
+			if (thread->cpu_mask & (1ULL << i))
+				CPU_SET(i, &cpus);
+		ret = pthread_setaffinity_np(thread->thread, sizeof cpus, &cpus);
+		if (ret != 0)
+			fprintf(stderr, "failed to set input thread affinity: %s\n",
+					strerror(ret));
+	}
+
+	return 0;
+}
+
+/* Stop and join the thread, delivering whatever it still queues meanwhile
+ * so it never stays blocked on a full queue. */
+void yt_thread_stop(struct yt_thread *thread)
+{
+	if (atomic_load(&thread->running)) {
+		yt_thread_wake(thread->stop_fd);
+		while (atomic_load(&thread->running)) {
+			yt_thread_drain(thread->event_fd, 0, thread);
+			sched_yield();
+		}
+		pthread_join(thread->thread, NULL);
+	}
+	yt_thread_drain(thread->event_fd, 0, thread);
+}
+
+void yt_thread_destroy(struct yt_thread *thread)
+{
+	struct yt_source *source, *next;
+
+	yt_thread_stop(thread);
+
+	wl_list_for_each_safe(source, next, &thread->destroy_list, link)
+		free(source);
+
+	pthread_mutex_destroy(&thread->mutex);
+	close(thread->epoll_fd);
+	close(thread->stop_fd);
+	close(thread->event_fd);
+	close(thread->space_fd);
+	free(thread->entries);
+	free(thread);
+}
+
+int yt_thread_epoll_fd(struct yt_thread *thread)
+{
+	return thread->epoll_fd;
+}
+
+int yt_thread_event_fd(struct yt_thread *thread)
+{
+	return thread->event_fd;
+}
+
+/* Taken by the compositor thread. The input thread may be holding the
+ * mutex while it waits for room in the queue, so keep draining until it
+ * lets go. */
+void yt_thread_lock(struct yt_thread *thread)
+{
+	while (pthread_mutex_trylock(&thread->mutex) != 0) {
+		yt_thread_drain(thread->event_fd, 0, thread);
+		sched_yield();
+	}
+}
+
+void yt_thread_unlock(struct yt_thread *thread)
+{
+	pthread_mutex_unlock(&thread->mutex);
+}
+
+/* Called with the lock held, after the source left the thread's epoll set */
+void yt_thread_release_source(struct yt_thread *thread, struct yt_source *source)
+{
+	wl_list_insert(&thread->destroy_list, &source->link);
+}
+
+/* Called with the lock held: the producer is idle, so the pending part of
+ * the queue can be walked safely. */
+void yt_thread_forget_device(struct yt_thread *thread, struct evdev_device *device)
+{
+	unsigned int i, head;
+
+	head = atomic_load_explicit(&thread->head, memory_order_acquire);
+	for (i = atomic_load(&thread->tail); i != head; i++)
+		if (thread->entries[i & thread->mask].device == device)
+			thread->entries[i & thread->mask].device = NULL;
+}
+
+static struct yt_thread_entry *yt_thread_reserve(struct yt_thread *thread)
+{
+	unsigned int head;
+
+	head = atomic_load_explicit(&thread->head, memory_order_relaxed);
+	while (head - atomic_load_explicit(&thread->tail, memory_order_acquire) >
+			thread->mask) {
+		uint64_t count;
+
+		/* Announce the wait before checking again, so that the
+		 * consumer either sees the flag or we see its progress. */
+		atomic_store(&thread->waiting, 1);
+		if (head - atomic_load(&thread->tail) > thread->mask) {
+			yt_thread_wake(thread->event_fd);
+			if (read(thread->space_fd, &count, sizeof count) < 0 &&
+					errno != EINTR)
+				fprintf(stderr, "input thread wait failed: %m\n");
+		}
+		atomic_store(&thread->waiting, 0);
+	}
+
+	return &thread->entries[head & thread->mask];
+}
+
+static void yt_thread_commit(struct yt_thread *thread)
+{
+	atomic_fetch_add_explicit(&thread->head, 1, memory_order_release);
+	thread->pushed = 1;
+}
+
+void yt_thread_push(struct yt_thread *thread, struct evdev_device *device,
+		const struct yt_event *event)
+{
+	struct yt_thread_entry *entry = yt_thread_reserve(thread);
+
+	entry->device = device;
+	entry->frame_end = 0;
+	entry->event = *event;
+	yt_thread_commit(thread);
+}
+
+void yt_thread_push_frame(struct yt_thread *thread, struct evdev_device *device)
+{
+	struct yt_thread_entry *entry = yt_thread_reserve(thread);
+
+	entry->device = device;
+	entry->frame_end = 1;
+	yt_thread_commit(thread);
+}
+
+/* Compositor side: hand everything queued so far to the seat callbacks.
+ * The entry is released before its callback runs, since the callback may
+ * remove devices and so end up draining again. */
+int yt_thread_drain(int fd, uint32_t mask __UNUSED__, void *data)
+{
+	struct yt_thread *thread = data;
+	struct yt_thread_entry entry;
+	unsigned int tail;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		return -1;
+
+	for (;;) {
+		tail = atomic_load_explicit(&thread->tail, memory_order_relaxed);
+		if (tail == atomic_load_explicit(&thread->head, memory_order_acquire))
+			break;
+
+		entry = thread->entries[tail & thread->mask];
+		atomic_store(&thread->tail, tail + 1);
+		if (atomic_load(&thread->waiting))
+			yt_thread_wake(thread->space_fd);
+
+		if (entry.device == NULL)
+			continue;
+		if (entry.frame_end)
+			evdev_frame_flush(entry.device);
+		else
+			evdev_frame_append(entry.device, &entry.event);
+	}
+
+	return 1;
+}
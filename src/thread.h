@@ -0,0 +1,27 @@
+#ifndef YT_THREAD_H
+#define YT_THREAD_H
+
+#include "yutani.h"
+#include "evdev.h"
+#include "common.h"
+
+struct yt_thread;
+
+struct yt_thread *yt_thread_create(const struct yt_seat_thread_config *config);
+int yt_thread_start(struct yt_thread *thread);
+void yt_thread_stop(struct yt_thread *thread);
+void yt_thread_destroy(struct yt_thread *thread);
+int yt_thread_epoll_fd(struct yt_thread *thread);
+int yt_thread_event_fd(struct yt_thread *thread);
+
+void yt_thread_lock(struct yt_thread *thread);
+void yt_thread_unlock(struct yt_thread *thread);
+void yt_thread_release_source(struct yt_thread *thread, struct yt_source *source);
+void yt_thread_forget_device(struct yt_thread *thread, struct evdev_device *device);
+
+void yt_thread_push(struct yt_thread *thread, struct evdev_device *device,
+		const struct yt_event *event);
+void yt_thread_push_frame(struct yt_thread *thread, struct evdev_device *device);
+int yt_thread_drain(int fd, uint32_t mask, void *data);
+
+#endif /* YT_THREAD_H */
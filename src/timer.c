@@ -0,0 +1,387 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "yutani.h"
+#include "common.h"
+#include "timer.h"
+
+#define YT_TIMER_SLOT_MASK ((uint64_t)YT_TIMER_SLOTS - 1)
+#define YT_TIMER_RANGE (1ULL << (YT_TIMER_LEVELS * YT_TIMER_LEVEL_BITS))
+
+struct yt_timer_wheel {
+	/* -1 for a virtual wheel, whose clock is kept in now instead */
+	int fd;
+	uint64_t now;
+	/* Next tick to expire; it only moves in yt_timer_wheel_run() */
+	uint64_t tick;
+	/* Tick being caught up to while running. Overdue timers armed
+	 * meanwhile go there so that they are not left behind. */
+	uint64_t target;
+	int running;
+	/* What the timerfd is set to, UINT64_MAX when it is idle. It may be
+	 * earlier than any armed timer, which costs a spurious wakeup. */
+	uint64_t armed;
+	unsigned int count;
+
+	/* Non-empty slots of each level */
+	uint64_t occupied[YT_TIMER_LEVELS];
+	struct wl_list slots[YT_TIMER_LEVELS][YT_TIMER_SLOTS];
+};
+
+uint64_t yt_timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void wheel_insert(struct yt_timer_wheel *wheel, struct yt_timer *timer)
+{
+	uint64_t base = wheel->running ? wheel->target : wheel->tick;
+	uint64_t expires = timer->deadline >> YT_TIMER_TICK_SHIFT;
+	uint64_t delta;
+	unsigned int level;
+
+	if (expires < base)
+		expires = base;
+	delta = expires - wheel->tick;
+	if (delta >= YT_TIMER_RANGE) {
+		expires = wheel->tick + YT_TIMER_RANGE - 1;
+		delta = YT_TIMER_RANGE - 1;
+	}
+
+	for (level = 0; level < YT_TIMER_LEVELS - 1; level++)
+		if (delta < 1ULL << ((level + 1) * YT_TIMER_LEVEL_BITS))
+			break;
+
+	timer->level = level;
+	timer->slot = (expires >> (level * YT_TIMER_LEVEL_BITS)) & YT_TIMER_SLOT_MASK;
+	wl_list_insert(&wheel->slots[level][timer->slot], &timer->link);
+	wheel->occupied[level] |= 1ULL << timer->slot;
+}
+
+static void wheel_unlink(struct yt_timer_wheel *wheel, struct yt_timer *timer)
+{
+	wl_list_remove(&timer->link);
+	if (wl_list_empty(&wheel->slots[timer->level][timer->slot]))
+		wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+}
+
+/* Detach a whole slot, so that whatever its timers do while they are
+ * handled cannot touch the list being walked. */
+static void wheel_take_slot(struct yt_timer_wheel *wheel, unsigned int level,
+		unsigned int slot, struct wl_list *list)
+{
+	wl_list_init(list);
+	wl_list_insert_list(list, &wheel->slots[level][slot]);
+	wl_list_init(&wheel->slots[level][slot]);
+	wheel->occupied[level] &= ~(1ULL << slot);
+}
+
+/* Entering the first tick of a slot of a higher level spreads the timers
+ * of that slot over the levels below. Higher levels go first, as they may
+ * refill the slot of the next level that is about to be cascaded. */
+static void wheel_cascade(struct yt_timer_wheel *wheel)
+{
+	struct yt_timer *timer;
+	struct wl_list list;
+	unsigned int level, shift;
+
+	for (level = YT_TIMER_LEVELS - 1; level > 0; level--) {
+		shift = level * YT_TIMER_LEVEL_BITS;
+		if (wheel->tick & ((1ULL << shift) - 1))
+			continue;
+
+		wheel_take_slot(wheel, level,
+				(wheel->tick >> shift) & YT_TIMER_SLOT_MASK, &list);
+		while (!wl_list_empty(&list)) {
+			timer = wl_container_of(list.next, timer, link);
+			wl_list_remove(&timer->link);
+			wheel_insert(wheel, timer);
+		}
+	}
+}
+
+static void wheel_expire(struct yt_timer_wheel *wheel, uint64_t now)
+{
+	unsigned int slot = wheel->tick & YT_TIMER_SLOT_MASK;
+	struct yt_timer *timer;
+	struct wl_list list;
+
+	if (!(wheel->occupied[0] & (1ULL << slot)))
+		return;
+
+	wheel_take_slot(wheel, 0, slot, &list);
+	while (!wl_list_empty(&list)) {
+		timer = wl_container_of(list.next, timer, link);
+		wl_list_remove(&timer->link);
+
+		/* Later in the tick, or parked beyond the range */
+		if (timer->deadline > now) {
+			wheel_insert(wheel, timer);
+			continue;
+		}
+
+		timer->wheel = NULL;
+		wheel->count--;
+		timer->func(timer, now);
+	}
+}
+
+/* The first non-empty slot of a level, counting from the current tick,
+ * holds its earliest timer. The current slot of a higher level was
+ * cascaded when it was entered, so it only has timers a full turn ahead. */
+static uint64_t wheel_next_deadline(struct yt_timer_wheel *wheel)
+{
+	uint64_t next = UINT64_MAX, bits;
+	struct yt_timer *timer;
+	unsigned int level, start, slot;
+
+	for (level = 0; level < YT_TIMER_LEVELS; level++) {
+		bits = wheel->occupied[level];
+		if (!bits)
+			continue;
+
+		start = (wheel->tick >> (level * YT_TIMER_LEVEL_BITS)) &
+			YT_TIMER_SLOT_MASK;
+		if (level)
+			start = (start + 1) & YT_TIMER_SLOT_MASK;
+		if (start)
+			bits = bits >> start | bits << (YT_TIMER_SLOTS - start);
+		slot = (start + __builtin_ctzll(bits)) & YT_TIMER_SLOT_MASK;
+
+		wl_list_for_each(timer, &wheel->slots[level][slot], link)
+			if (timer->deadline < next)
+				next = timer->deadline;
+	}
+
+	return next;
+}
+
+/* The timerfd is only set again when the earliest deadline moves up. */
+static void wheel_arm_fd(struct yt_timer_wheel *wheel, uint64_t deadline)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+	if (wheel->fd < 0 || deadline >= wheel->armed)
+		return;
+
+	its.it_value.tv_sec = deadline / 1000000000;
+	its.it_value.tv_nsec = deadline % 1000000000;
+	/* All zeroes would disarm it */
+	if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+		its.it_value.tv_nsec = 1;
+
+	if (timerfd_settime(wheel->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		fprintf(stderr, "could not set timerfd: %m\n");
+		return;
+	}
+	wheel->armed = deadline;
+}
+
+void yt_timer_init(struct yt_timer *timer, yt_timer_func_t func, void *data)
+{
+	timer->deadline = 0;
+	timer->func = func;
+	timer->data = data;
+	timer->wheel = NULL;
+	wl_list_init(&timer->link);
+}
+
+void yt_timer_arm(struct yt_timer_wheel *wheel, struct yt_timer *timer,
+		uint64_t deadline)
+{
+	yt_timer_cancel(timer);
+
+	/* An empty wheel may not have run for a long while */
+	if (wheel->count == 0 && !wheel->running)
+		wheel->tick = yt_timer_wheel_now(wheel) >> YT_TIMER_TICK_SHIFT;
+
+	timer->deadline = deadline;
+	timer->wheel = wheel;
+	wheel_insert(wheel, timer);
+	wheel->count++;
+
+	if (!wheel->running)
+		wheel_arm_fd(wheel, deadline);
+}
+
+void yt_timer_cancel(struct yt_timer *timer)
+{
+	struct yt_timer_wheel *wheel = timer->wheel;
+
+	if (!wheel)
+		return;
+
+	wheel_unlink(wheel, timer);
+	wheel->count--;
+	timer->wheel = NULL;
+}
+
+static struct yt_timer_wheel *wheel_alloc(int fd, uint64_t now)
+{
+	struct yt_timer_wheel *wheel;
+	unsigned int level, slot;
+
+	wheel = calloc(1, sizeof *wheel);
+	if (!wheel)
+		return NULL;
+
+	for (level = 0; level < YT_TIMER_LEVELS; level++)
+		for (slot = 0; slot < YT_TIMER_SLOTS; slot++)
+			wl_list_init(&wheel->slots[level][slot]);
+	wheel->fd = fd;
+	wheel->now = now;
+	wheel->tick = now >> YT_TIMER_TICK_SHIFT;
+	wheel->armed = UINT64_MAX;
+
+	return wheel;
+}
+
+struct yt_timer_wheel *yt_timer_wheel_create(void)
+{
+	struct yt_timer_wheel *wheel;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0)
+		return NULL;
+
+	wheel = wheel_alloc(fd, yt_timer_now());
+	if (!wheel)
+		close(fd);
+	return wheel;
+}
+
+/* A wheel without a timerfd, whose clock starts at now and only moves
+ * when it is run. Nothing expires unless the owner runs it. */
+struct yt_timer_wheel *yt_timer_wheel_create_virtual(uint64_t now)
+{
+	return wheel_alloc(-1, now);
+}
+
+/* Timers still armed are left idle, their owners may yet cancel them. */
+void yt_timer_wheel_destroy(struct yt_timer_wheel *wheel)
+{
+	struct yt_timer *timer, *next;
+	unsigned int level, slot;
+
+	if (!wheel)
+		return;
+
+	for (level = 0; level < YT_TIMER_LEVELS; level++)
+		for (slot = 0; slot < YT_TIMER_SLOTS; slot++)
+			wl_list_for_each_safe(timer, next,
+					&wheel->slots[level][slot], link) {
+				wl_list_init(&timer->link);
+				timer->wheel = NULL;
+			}
+
+	if (wheel->fd >= 0)
+		close(wheel->fd);
+	free(wheel);
+}
+
+/* -1 for virtual wheels */
+int yt_timer_wheel_fd(struct yt_timer_wheel *wheel)
+{
+	return wheel->fd;
+}
+
+/* The clock deadlines on this wheel are measured against */
+uint64_t yt_timer_wheel_now(struct yt_timer_wheel *wheel)
+{
+	return wheel->fd < 0 ? wheel->now : yt_timer_now();
+}
+
+/* Earliest deadline armed, UINT64_MAX if there is none */
+uint64_t yt_timer_wheel_next(struct yt_timer_wheel *wheel)
+{
+	return wheel->count ? wheel_next_deadline(wheel) : UINT64_MAX;
+}
+
+/* Expire everything due by now. Empty stretches are skipped up to the
+ * next occupied slot or the next cascade, whichever comes first. */
+void yt_timer_wheel_run(struct yt_timer_wheel *wheel, uint64_t now)
+{
+	uint64_t next, bits;
+	unsigned int slot;
+
+	/* A virtual clock never goes back */
+	if (now > wheel->now)
+		wheel->now = now;
+
+	wheel->target = now >> YT_TIMER_TICK_SHIFT;
+	if (wheel->target < wheel->tick)
+		wheel->target = wheel->tick;
+	if (wheel->count == 0)
+		wheel->tick = wheel->target;
+	wheel->running = 1;
+
+	for (;;) {
+		wheel_expire(wheel, now);
+		if (wheel->tick == wheel->target)
+			break;
+
+		slot = wheel->tick & YT_TIMER_SLOT_MASK;
+		bits = slot == YT_TIMER_SLOT_MASK ? 0 :
+			wheel->occupied[0] & (~0ULL << (slot + 1));
+		if (wheel->count == 0)
+			next = wheel->target;
+		else if (bits)
+			next = (wheel->tick & ~YT_TIMER_SLOT_MASK) +
+				__builtin_ctzll(bits);
+		else
+			next = (wheel->tick | YT_TIMER_SLOT_MASK) + 1;
+		if (next > wheel->target)
+			next = wheel->target;
+
+		wheel->tick = next;
+		if (!(next & YT_TIMER_SLOT_MASK))
+			wheel_cascade(wheel);
+	}
+
+	wheel->running = 0;
+	if (wheel->armed <= now)
+		wheel->armed = UINT64_MAX;
+	wheel_arm_fd(wheel, wheel_next_deadline(wheel));
+}
+
+int yt_timer_wheel_handler(int fd, uint32_t mask __UNUSED__, void *data)
+{
+	uint64_t expirations;
+
+	/* Consume the expiration so the timerfd stops polling readable. */
+	if (read(fd, &expirations, sizeof expirations) < 0 && errno != EAGAIN)
+		return 1;
+
+	yt_timer_wheel_run(data, yt_timer_now());
+
+	return 1;
+}
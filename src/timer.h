@@ -0,0 +1,76 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef YT_TIMER_H
+#define YT_TIMER_H
+
+#include <stdint.h>
+#include <wayland-util.h>
+
+/* Deadlines are CLOCK_MONOTONIC nanoseconds. The wheel counts in ticks of
+ * 2^20 ns, about a millisecond, and has four levels of 64 slots, so it
+ * spans some five hours; later deadlines are parked in the last slot. */
+#define YT_TIMER_TICK_SHIFT 20
+#define YT_TIMER_LEVEL_BITS 6
+#define YT_TIMER_LEVELS 4
+#define YT_TIMER_SLOTS (1 << YT_TIMER_LEVEL_BITS)
+
+struct yt_timer;
+struct yt_timer_wheel;
+
+/* Runs from yt_timer_wheel_run(), with the timer already disarmed so it
+ * may be armed again right away. */
+typedef void (*yt_timer_func_t)(struct yt_timer *timer, uint64_t now);
+
+struct yt_timer {
+	uint64_t deadline;
+	yt_timer_func_t func;
+	void *data;
+
+	/* Wheel the timer is armed in, NULL while it is idle */
+	struct yt_timer_wheel *wheel;
+	uint8_t level;
+	uint8_t slot;
+	struct wl_list link;
+};
+
+uint64_t yt_timer_now(void);
+
+void yt_timer_init(struct yt_timer *timer, yt_timer_func_t func, void *data);
+void yt_timer_arm(struct yt_timer_wheel *wheel, struct yt_timer *timer,
+		uint64_t deadline);
+void yt_timer_cancel(struct yt_timer *timer);
+
+static inline int yt_timer_armed(const struct yt_timer *timer)
+{
+	return timer->wheel != NULL;
+}
+
+struct yt_timer_wheel *yt_timer_wheel_create(void);
+struct yt_timer_wheel *yt_timer_wheel_create_virtual(uint64_t now);
+void yt_timer_wheel_destroy(struct yt_timer_wheel *wheel);
+int yt_timer_wheel_fd(struct yt_timer_wheel *wheel);
+uint64_t yt_timer_wheel_now(struct yt_timer_wheel *wheel);
+uint64_t yt_timer_wheel_next(struct yt_timer_wheel *wheel);
+void yt_timer_wheel_run(struct yt_timer_wheel *wheel, uint64_t now);
+int yt_timer_wheel_handler(int fd, uint32_t mask, void *data);
+
+#endif /* YT_TIMER_H */
@@ -0,0 +1,28 @@
+#ifndef YT_TRACE_H
+#define YT_TRACE_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* Static tracepoints in the "yutani" provider, for bpftrace, perf or
+ * systemtap. Each one is a single nop until a tracer attaches to it.
+ * Without <sys/sdt.h> they compile to nothing. */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define YT_TRACE0(name) DTRACE_PROBE(yutani, name)
+#define YT_TRACE1(name, a) DTRACE_PROBE1(yutani, name, a)
+#define YT_TRACE2(name, a, b) DTRACE_PROBE2(yutani, name, a, b)
+#define YT_TRACE3(name, a, b, c) DTRACE_PROBE3(yutani, name, a, b, c)
+#else
+/* The arguments are not evaluated, only kept from being unused */
+#define YT_TRACE0(name) do { } while (0)
+#define YT_TRACE1(name, a) do { (void)sizeof(a); } while (0)
+#define YT_TRACE2(name, a, b) \
+	do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define YT_TRACE3(name, a, b, c) \
+	do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#endif
+
+#endif /* YT_TRACE_H */
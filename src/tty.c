@@ -36,6 +36,7 @@
 
 #include <sys/signalfd.h>
 #include "tty.h"
+#include "trace.h"
 /* Introduced in 2.6.38 */
 #ifndef K_OFF
 #define K_OFF 0x04
@@ -68,11 +69,13 @@ int tty_vt_handler(int signal_number __UNUSED__, void *data)
 	struct tty *tty = data;
 
 	if (tty->has_vt) {
+		YT_TRACE1(vt_release, tty->vt);
 		tty->vt_func(tty->data, TTY_LEAVE_VT);
 		tty->has_vt = 0;
 
 		ioctl(tty->event_fd, VT_RELDISP, 1);
 	} else {
+		YT_TRACE1(vt_acquire, tty->vt);
 		ioctl(tty->event_fd, VT_RELDISP, VT_ACKACQ);
 
 		tty->vt_func(tty->data, TTY_ENTER_VT);
@@ -82,6 +85,17 @@ int tty_vt_handler(int signal_number __UNUSED__, void *data)
 	return 1;
 }
 
+int tty_signal_handler(int fd, uint32_t mask __UNUSED__, void *data)
+{
+	struct signalfd_siginfo info;
+
+	/* Drain the signalfd, every SIGUSR1 is one VT release or acquire. */
+	while (read(fd, &info, sizeof info) == sizeof info)
+		tty_vt_handler(info.ssi_signo, data);
+
+	return 1;
+}
+
 int on_tty_input(int fd __UNUSED__, uint32_t mask __UNUSED__, void *data)
 {
 	struct tty *tty = data;
@@ -224,7 +238,7 @@ struct tty *tty_create(int tty_fd, int tty_nr, yt_tty_vt_func_t vt_func, void *d
 	sigset_t sig_mask;
 	sigemptyset(&sig_mask);
 	sigaddset(&sig_mask, SIGUSR1);
-	if ((tty->signal_fd = signalfd(-1, &sig_mask, SFD_CLOEXEC)) < 0)
+	if ((tty->signal_fd = signalfd(-1, &sig_mask, SFD_CLOEXEC | SFD_NONBLOCK)) < 0)
 		goto err_vtmode;
 	sigprocmask(SIG_BLOCK, &sig_mask, NULL);
 
@@ -8,6 +8,7 @@
 #include "evdev.h"
 #include "udev.h"
 #include "common.h"
+#include "trace.h"
 
 int evdev_udev_handler(int fd __UNUSED__, uint mask __UNUSED__, void *data)
 {
@@ -31,13 +32,17 @@ int evdev_udev_handler(int fd __UNUSED__, uint mask __UNUSED__, void *data)
 
 	if (!strcmp(action, "add")) {
 		device = device_added(udev_device, seat);
-		seat->hotplug_cb.add_cb(&device->base, seat->hotplug_data);
+		YT_TRACE2(hotplug_add, udev_device_get_devnode(udev_device), device);
+		if (device && seat->hotplug_cb.add_cb)
+			seat->hotplug_cb.add_cb(&device->base, seat->hotplug_data);
 	} else if (!strcmp(action, "remove")) {
 		devnode = udev_device_get_devnode(udev_device);
 
 		wl_list_for_each_safe(yt_dev, next, &seat->devices_list, all_devices_link) {
 			if (!strcmp(yt_dev->devnode, devnode)) {
-				seat->hotplug_cb.del_cb(yt_dev, seat->hotplug_data);
+				YT_TRACE1(hotplug_remove, devnode);
+				if (seat->hotplug_cb.del_cb)
+					seat->hotplug_cb.del_cb(yt_dev, seat->hotplug_data);
 				evdev_device_destroy(evdev_device(yt_dev));
 				break;
 			}
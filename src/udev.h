@@ -17,6 +17,7 @@ struct udev_context {
 	struct udev *udev;
 	struct yt_hotplug_cbs hotplug_cb;
 	void *hotplug_data;
+	enum yt_io_backend io_backend;
 };
 
 int evdev_enable_udev_monitor(struct udev_context *master);
@@ -0,0 +1,340 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <liburing.h>
+
+#include "uring.h"
+#include "common.h"
+#include "timer.h"
+
+#define YT_URING_ENTRIES 256
+#define YT_URING_BATCH 64
+
+/* The linked poll of a request carries the request pointer with this bit
+ * set, so its completion can be told apart from the read. */
+#define YT_URING_POLL_TAG 1
+
+enum yt_uring_req_type {
+	YT_URING_REQ_DEVICE,
+	YT_URING_REQ_TIMER
+};
+
+enum yt_uring_req_state {
+	YT_URING_REQ_IDLE,
+	YT_URING_REQ_POSTED,
+	YT_URING_REQ_COMPLETING
+};
+
+struct yt_uring {
+	struct io_uring ring;
+	struct yt_seat *seat;
+	int event_fd;
+	struct yt_source *source;
+};
+
+/* A read kept posted on one fd. The request owns its buffer, so a removed
+ * device can be freed while the cancelled read is still in flight. */
+struct yt_uring_req {
+	enum yt_uring_req_type type;
+	enum yt_uring_req_state state;
+	int fd;
+	/* NULL once the request is cancelled */
+	void *data;
+	size_t size;
+	void *buf;
+};
+
+/* Returns -1 if the submission queue has no room even after a submit. */
+static int yt_uring_post(struct yt_uring *uring, struct yt_uring_req *req)
+{
+	struct io_uring_sqe *sqe;
+
+	/* Both sqes are reserved before either is prepared: a submit in
+	 * between would send the linked poll without its read. */
+	if (io_uring_sq_space_left(&uring->ring) < 2)
+		io_uring_submit(&uring->ring);
+	if (io_uring_sq_space_left(&uring->ring) < 2)
+		return -1;
+
+	/* Wait for the fd to become readable before reading, so the read
+	 * never fails with EAGAIN on the non-blocking fds. */
+	sqe = io_uring_get_sqe(&uring->ring);
+	io_uring_prep_poll_add(sqe, req->fd, POLLIN);
+	io_uring_sqe_set_data64(sqe, (uintptr_t)req | YT_URING_POLL_TAG);
+	io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+
+	sqe = io_uring_get_sqe(&uring->ring);
+	io_uring_prep_read(sqe, req->fd, req->buf, req->size, (uint64_t)-1);
+	io_uring_sqe_set_data64(sqe, (uintptr_t)req);
+
+	req->state = YT_URING_REQ_POSTED;
+	return 0;
+}
+
+static void yt_uring_req_destroy(struct yt_uring_req *req)
+{
+	free(req->buf);
+	free(req);
+}
+
+static struct yt_uring_req *yt_uring_req_create(struct yt_uring *uring,
+		enum yt_uring_req_type type, int fd, void *data, size_t size)
+{
+	struct yt_uring_req *req;
+
+	req = calloc(1, sizeof *req);
+	if (req == NULL)
+		return NULL;
+
+	req->buf = malloc(size);
+	if (req->buf == NULL) {
+		free(req);
+		return NULL;
+	}
+
+	req->type = type;
+	req->fd = fd;
+	req->data = data;
+	req->size = size;
+
+	if (yt_uring_post(uring, req) < 0) {
+		yt_uring_req_destroy(req);
+		return NULL;
+	}
+	io_uring_submit(&uring->ring);
+
+	return req;
+}
+
+/* Returns 1 if the read should be posted again, 0 to leave it idle and
+ * -1 to hand the fd back to epoll. */
+static int yt_uring_device_complete(struct yt_uring_req *req, int res)
+{
+	struct evdev_device *device = req->data;
+	size_t size = sizeof(struct input_event);
+	void *buf;
+
+	device->stats.syscalls++;
+	if (res < 0) {
+		if (res != -EAGAIN)
+			device->stats.read_errors++;
+		if (res == -EAGAIN || res == -EINTR)
+			return 1;
+		/* The device is gone, hotplug will remove it */
+		if (res == -ENODEV)
+			return 0;
+		/* A failed poll cancels the linked read with ECANCELED */
+		fprintf(stderr, "io_uring read failed on %s: %s\n",
+				device->base.devnode, strerror(-res));
+		return -1;
+	}
+
+	evdev_device_input(device, req->buf, res / size);
+
+	/* Same growth policy as the read path: a full read means the
+	 * buffer is too small for this device's bursts. */
+	if ((size_t)res == req->size && req->size < EVDEV_BUFFER_MAX * size) {
+		buf = realloc(req->buf, req->size * 2);
+		if (buf) {
+			req->buf = buf;
+			req->size *= 2;
+		}
+	}
+
+	return 1;
+}
+
+/* The read consumed the expirations, the wheel runs what is due */
+static int yt_uring_timer_complete(struct yt_uring_req *req, int res)
+{
+	if (res < 0) {
+		if (res == -EAGAIN || res == -EINTR)
+			return 1;
+		fprintf(stderr, "io_uring timer read failed: %s\n",
+				strerror(-res));
+		return -1;
+	}
+
+	yt_timer_wheel_run(req->data, yt_timer_now());
+
+	return 1;
+}
+
+static int yt_uring_complete(struct yt_uring_req *req, int res)
+{
+	switch (req->type) {
+		case YT_URING_REQ_DEVICE:
+			return yt_uring_device_complete(req, res);
+		case YT_URING_REQ_TIMER:
+			return yt_uring_timer_complete(req, res);
+	}
+
+	return -1;
+}
+
+/* The request is dropped and its fd watched through epoll again, so a
+ * failing ring never silently stops a device or the timers. */
+static void yt_uring_fallback(struct yt_uring *uring, struct yt_uring_req *req)
+{
+	switch (req->type) {
+		case YT_URING_REQ_DEVICE:
+			yt_device_uring_fallback(req->data);
+			break;
+		case YT_URING_REQ_TIMER:
+			yt_seat_timers_uring_fallback(uring->seat);
+			break;
+	}
+
+	yt_uring_req_destroy(req);
+}
+
+static int yt_uring_handler(int fd, uint32_t mask __UNUSED__, void *data)
+{
+	struct yt_uring *uring = data;
+	struct io_uring_cqe *cqes[YT_URING_BATCH];
+	struct yt_uring_req *req;
+	uint64_t value, user_data;
+	unsigned int count, i;
+	int repost;
+
+	if (read(fd, &value, sizeof value) < 0 && errno != EAGAIN)
+		return 1;
+
+	do {
+		count = io_uring_peek_batch_cqe(&uring->ring, cqes, YT_URING_BATCH);
+		for (i = 0; i < count; i++) {
+			user_data = io_uring_cqe_get_data64(cqes[i]);
+			if (user_data == 0 || (user_data & YT_URING_POLL_TAG))
+				continue;
+
+			/* The handlers may remove the request they run for,
+			 * which only flags it while it is completing. */
+			req = (struct yt_uring_req *)(uintptr_t)user_data;
+			req->state = YT_URING_REQ_COMPLETING;
+			repost = req->data ? yt_uring_complete(req, cqes[i]->res) : 0;
+			if (req->data == NULL) {
+				yt_uring_req_destroy(req);
+				continue;
+			}
+			if (repost > 0 && yt_uring_post(uring, req) < 0) {
+				fprintf(stderr, "io_uring submission queue full, "
+						"using epoll\n");
+				repost = -1;
+			}
+			if (repost == 0)
+				req->state = YT_URING_REQ_IDLE;
+			else if (repost < 0)
+				yt_uring_fallback(uring, req);
+		}
+		io_uring_cq_advance(&uring->ring, count);
+	} while (count == YT_URING_BATCH);
+
+	/* One submit re-arms every fd that completed in this batch. */
+	io_uring_submit(&uring->ring);
+
+	return 1;
+}
+
+struct yt_uring *yt_uring_create(struct yt_seat *seat)
+{
+	struct yt_uring *uring;
+
+	uring = calloc(1, sizeof *uring);
+	if (uring == NULL)
+		return NULL;
+
+	if (io_uring_queue_init(YT_URING_ENTRIES, &uring->ring, 0) < 0)
+		goto err_free;
+	uring->seat = seat;
+
+	uring->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (uring->event_fd < 0)
+		goto err_ring;
+
+	if (io_uring_register_eventfd(&uring->ring, uring->event_fd) < 0)
+		goto err_eventfd;
+
+	uring->source = yt_seat_source_add(seat, uring->event_fd,
+			YT_SOURCE_DEVICE, yt_uring_handler, uring);
+	if (uring->source == NULL)
+		goto err_eventfd;
+
+	return uring;
+
+err_eventfd:
+	close(uring->event_fd);
+err_ring:
+	io_uring_queue_exit(&uring->ring);
+err_free:
+	free(uring);
+	return NULL;
+}
+
+struct yt_uring_req *yt_uring_add_device(struct yt_uring *uring, struct evdev_device *device)
+{
+	return yt_uring_req_create(uring, YT_URING_REQ_DEVICE, device->base.fd,
+			device, device->buffer.size * sizeof(struct input_event));
+}
+
+struct yt_uring_req *yt_uring_add_timer(struct yt_uring *uring, struct yt_timer_wheel *wheel)
+{
+	return yt_uring_req_create(uring, YT_URING_REQ_TIMER,
+			yt_timer_wheel_fd(wheel), wheel, sizeof(uint64_t));
+}
+
+/* Cancel the posted poll; the linked read then completes with ECANCELED
+ * and the request is freed from the completion handler. */
+void yt_uring_remove(struct yt_uring *uring, struct yt_uring_req *req)
+{
+	struct io_uring_sqe *sqe;
+
+	if (req == NULL)
+		return;
+
+	if (req->state == YT_URING_REQ_IDLE) {
+		yt_uring_req_destroy(req);
+		return;
+	}
+
+	req->data = NULL;
+	if (req->state == YT_URING_REQ_COMPLETING)
+		return;
+
+	sqe = io_uring_get_sqe(&uring->ring);
+	if (sqe == NULL) {
+		io_uring_submit(&uring->ring);
+		sqe = io_uring_get_sqe(&uring->ring);
+	}
+	/* Left to complete on its own, it is freed then */
+	if (sqe == NULL) {
+		fprintf(stderr, "io_uring submission queue full, "
+				"cannot cancel read on fd %d\n", req->fd);
+		return;
+	}
+	io_uring_prep_cancel64(sqe, (uintptr_t)req | YT_URING_POLL_TAG, 0);
+	io_uring_sqe_set_data64(sqe, 0);
+	io_uring_submit(&uring->ring);
+}
@@ -0,0 +1,19 @@
+#ifndef YT_URING_H
+#define YT_URING_H
+
+#include "yutani.h"
+#include "evdev.h"
+
+struct yt_uring;
+struct yt_uring_req;
+
+struct yt_uring *yt_uring_create(struct yt_seat *seat);
+struct yt_uring_req *yt_uring_add_device(struct yt_uring *uring, struct evdev_device *device);
+struct yt_uring_req *yt_uring_add_timer(struct yt_uring *uring, struct yt_timer_wheel *wheel);
+void yt_uring_remove(struct yt_uring *uring, struct yt_uring_req *req);
+
+/* Put back on the seat's epoll fd when the ring gives up on them */
+void yt_device_uring_fallback(struct evdev_device *device);
+void yt_seat_timers_uring_fallback(struct yt_seat *seat);
+
+#endif /* YT_URING_H */
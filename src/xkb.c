@@ -0,0 +1,190 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "xkb.h"
+
+/* evdev codes are offset by 8 in X keycodes */
+#define YT_XKB_KEYCODE(key) ((key) + 8)
+
+#define YT_XKB_MODS_CHANGED (XKB_STATE_MODS_DEPRESSED | \
+		XKB_STATE_MODS_LATCHED | XKB_STATE_MODS_LOCKED | \
+		XKB_STATE_LAYOUT_EFFECTIVE)
+
+struct yt_xkb {
+	struct xkb_context *context;
+	struct xkb_keymap *keymap;
+	struct xkb_state *state;
+
+	/* Serialized state as of the last key */
+	struct yt_modifiers modifiers;
+
+	/* First level of the first layout, which is what every key gives
+	 * while no modifier is active. */
+	xkb_keysym_t syms[YT_XKB_TABLE_SIZE];
+};
+
+struct yt_xkb *yt_xkb_create(void)
+{
+	return calloc(1, sizeof(struct yt_xkb));
+}
+
+void yt_xkb_destroy(struct yt_xkb *xkb)
+{
+	if (!xkb)
+		return;
+
+	xkb_state_unref(xkb->state);
+	xkb_keymap_unref(xkb->keymap);
+	xkb_context_unref(xkb->context);
+	free(xkb);
+}
+
+static void yt_xkb_fill_table(struct yt_xkb *xkb)
+{
+	const xkb_keysym_t *syms;
+	uint32_t key;
+
+	for (key = 0; key < YT_XKB_TABLE_SIZE; key++) {
+		if (xkb_keymap_key_get_syms_by_level(xkb->keymap,
+					YT_XKB_KEYCODE(key), 0, 0, &syms) == 1)
+			xkb->syms[key] = syms[0];
+		else
+			xkb->syms[key] = XKB_KEY_NoSymbol;
+	}
+}
+
+/* Compile a keymap from RMLVO names; NULL names take the defaults of
+ * libxkbcommon and the XKB_DEFAULT_* environment. The new state starts
+ * out without modifiers, which are filled in under a new serial. */
+int yt_xkb_keymap_set(struct yt_xkb *xkb, const struct xkb_rule_names *names,
+		struct yt_modifiers *modifiers)
+{
+	struct xkb_keymap *keymap;
+	struct xkb_state *state;
+
+	if (!xkb->context) {
+		xkb->context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+		if (!xkb->context) {
+			fprintf(stderr, "failed to create xkb context\n");
+			return -1;
+		}
+	}
+
+	keymap = xkb_keymap_new_from_names(xkb->context, names,
+			XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (!keymap) {
+		fprintf(stderr, "failed to compile keymap\n");
+		return -1;
+	}
+
+	state = xkb_state_new(keymap);
+	if (!state) {
+		fprintf(stderr, "failed to create xkb state\n");
+		xkb_keymap_unref(keymap);
+		return -1;
+	}
+
+	xkb_state_unref(xkb->state);
+	xkb_keymap_unref(xkb->keymap);
+	xkb->keymap = keymap;
+	xkb->state = state;
+
+	xkb->modifiers.depressed = 0;
+	xkb->modifiers.latched = 0;
+	xkb->modifiers.locked = 0;
+	xkb->modifiers.group = 0;
+	xkb->modifiers.serial++;
+	*modifiers = xkb->modifiers;
+	yt_xkb_fill_table(xkb);
+
+	return 0;
+}
+
+char *yt_xkb_keymap_get_string(struct yt_xkb *xkb)
+{
+	if (!xkb->keymap)
+		return NULL;
+	return xkb_keymap_get_as_string(xkb->keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+}
+
+/* The keysym a key gives in the current state, so it has to be taken
+ * before the key itself is applied. */
+xkb_keysym_t yt_xkb_key_get_sym(struct yt_xkb *xkb, uint32_t key)
+{
+	const struct yt_modifiers *mods = &xkb->modifiers;
+
+	if (!xkb->state)
+		return XKB_KEY_NoSymbol;
+
+	if (key < YT_XKB_TABLE_SIZE &&
+			!(mods->depressed | mods->latched | mods->locked | mods->group))
+		return xkb->syms[key];
+
+	return xkb_state_key_get_one_sym(xkb->state, YT_XKB_KEYCODE(key));
+}
+
+/* -1 without a keymap, leaving it to the caller */
+int yt_xkb_key_repeats(struct yt_xkb *xkb, uint32_t key)
+{
+	if (!xkb->keymap)
+		return -1;
+	return xkb_keymap_key_repeats(xkb->keymap, YT_XKB_KEYCODE(key));
+}
+
+/* Apply a press or release. Returns 1, with modifiers filled in under a
+ * new serial, only when the serialized modifiers or group changed. */
+int yt_xkb_key_update(struct yt_xkb *xkb, uint32_t key, int pressed,
+		struct yt_modifiers *modifiers)
+{
+	struct yt_modifiers *mods = &xkb->modifiers;
+	enum xkb_state_component changed;
+	uint32_t depressed, latched, locked, group;
+
+	if (!xkb->state)
+		return 0;
+
+	changed = xkb_state_update_key(xkb->state, YT_XKB_KEYCODE(key),
+			pressed ? XKB_KEY_DOWN : XKB_KEY_UP);
+	if (!(changed & YT_XKB_MODS_CHANGED))
+		return 0;
+
+	depressed = xkb_state_serialize_mods(xkb->state, XKB_STATE_MODS_DEPRESSED);
+	latched = xkb_state_serialize_mods(xkb->state, XKB_STATE_MODS_LATCHED);
+	locked = xkb_state_serialize_mods(xkb->state, XKB_STATE_MODS_LOCKED);
+	group = xkb_state_serialize_layout(xkb->state, XKB_STATE_LAYOUT_EFFECTIVE);
+	if (depressed == mods->depressed && latched == mods->latched &&
+			locked == mods->locked && group == mods->group)
+		return 0;
+
+	mods->serial++;
+	mods->depressed = depressed;
+	mods->latched = latched;
+	mods->locked = locked;
+	mods->group = group;
+	*modifiers = *mods;
+
+	return 1;
+}
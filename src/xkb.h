@@ -0,0 +1,48 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef YT_XKB_H
+#define YT_XKB_H
+
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "yutani.h"
+
+/* Keys below this have their keysym without modifiers in a table */
+#define YT_XKB_TABLE_SIZE 256
+
+/* Keymap and modifier state of a seat. It exists from the start and does
+ * nothing until a keymap is set. */
+struct yt_xkb;
+
+struct yt_xkb *yt_xkb_create(void);
+void yt_xkb_destroy(struct yt_xkb *xkb);
+int yt_xkb_keymap_set(struct yt_xkb *xkb, const struct xkb_rule_names *names,
+		struct yt_modifiers *modifiers);
+char *yt_xkb_keymap_get_string(struct yt_xkb *xkb);
+
+xkb_keysym_t yt_xkb_key_get_sym(struct yt_xkb *xkb, uint32_t key);
+int yt_xkb_key_repeats(struct yt_xkb *xkb, uint32_t key);
+int yt_xkb_key_update(struct yt_xkb *xkb, uint32_t key, int pressed,
+		struct yt_modifiers *modifiers);
+
+#endif /* YT_XKB_H */
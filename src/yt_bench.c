@@ -0,0 +1,519 @@
+/*
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#include "yutani.h"
+#include "record.h"
+#include "common.h"
+
+#define BENCH_RUNS 5
+#define BENCH_FRAMES 100000
+
+static int counting;
+static unsigned long allocs;
+
+/* Allocations made by the library while a run is being measured. The
+ * allocator is interposed here and forwards to glibc's internal entry
+ * points, so counting is only available on glibc; elsewhere the allocs
+ * column reads "-". The program is built with hidden visibility, and
+ * the library only sees these if they are exported. */
+#ifdef __GLIBC__
+#define BENCH_COUNTS_ALLOCS 1
+#define BENCH_EXPORT __attribute__ ((visibility("default")))
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+BENCH_EXPORT void *malloc(size_t size)
+{
+	if (counting)
+		allocs++;
+	return __libc_malloc(size);
+}
+
+BENCH_EXPORT void *calloc(size_t nmemb, size_t size)
+{
+	if (counting)
+		allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+BENCH_EXPORT void *realloc(void *ptr, size_t size)
+{
+	if (counting)
+		allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+BENCH_EXPORT void *memalign(size_t alignment, size_t size)
+{
+	if (counting)
+		allocs++;
+	return __libc_memalign(alignment, size);
+}
+
+BENCH_EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+BENCH_EXPORT int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	void *p;
+
+	if (alignment % sizeof(void *) || alignment & (alignment - 1))
+		return EINVAL;
+
+	p = memalign(alignment, size);
+	if (!p)
+		return ENOMEM;
+	*ptr = p;
+	return 0;
+}
+#else
+#define BENCH_COUNTS_ALLOCS 0
+#endif
+
+struct bench_stream {
+	struct input_event *ev;
+	size_t count;
+	size_t alloc;
+	uint64_t time;
+};
+
+struct bench_scenario {
+	const char *name;
+	void (*caps)(struct evdev_caps *caps);
+	void (*frame)(struct bench_stream *stream, unsigned int i);
+};
+
+/* Time between two delivered frames, i.e. the cost of one frame */
+static uint64_t *samples;
+static size_t sample_count;
+static size_t sample_max;
+static uint64_t last_frame;
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void frame_cb(struct yt_device *device __UNUSED__, void *data __UNUSED__,
+		const struct yt_event *events __UNUSED__, int count __UNUSED__)
+{
+	uint64_t now = bench_now();
+
+	if (last_frame && sample_count < sample_max)
+		samples[sample_count++] = now - last_frame;
+	last_frame = now;
+}
+
+static struct yt_seat_notify_interface notify_api = {
+	.notify_frame = frame_cb
+};
+
+static void stream_add(struct bench_stream *stream, uint16_t type,
+		uint16_t code, int32_t value)
+{
+	struct input_event *e;
+
+	if (stream->count == stream->alloc) {
+		stream->alloc = stream->alloc ? stream->alloc * 2 : 4096;
+		stream->ev = realloc(stream->ev, stream->alloc * sizeof *e);
+		if (!stream->ev) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+
+	e = &stream->ev[stream->count++];
+	e->time.tv_sec = stream->time / 1000000000;
+	e->time.tv_usec = stream->time % 1000000000 / 1000;
+	e->type = type;
+	e->code = code;
+	e->value = value;
+}
+
+/* Frames are spaced as a 1 kHz device would send them */
+static void stream_sync(struct bench_stream *stream)
+{
+	stream_add(stream, EV_SYN, SYN_REPORT, 0);
+	stream->time += 1000000;
+}
+
+static void caps_abs(struct evdev_caps *caps, uint16_t code, int32_t max)
+{
+	SET_BIT(caps->ev, EV_ABS);
+	SET_BIT(caps->abs, code);
+	caps->absinfo[code].minimum = 0;
+	caps->absinfo[code].maximum = max;
+}
+
+static void caps_key(struct evdev_caps *caps, uint16_t code)
+{
+	SET_BIT(caps->ev, EV_KEY);
+	SET_BIT(caps->key, code);
+}
+
+static void keyboard_caps(struct evdev_caps *caps)
+{
+	unsigned int code;
+
+	for (code = KEY_ESC; code <= KEY_KPDOT; code++)
+		caps_key(caps, code);
+}
+
+static void keyboard_frame(struct bench_stream *stream, unsigned int i)
+{
+	uint16_t key = KEY_Q + i / 2 % 10;
+
+	stream_add(stream, EV_MSC, MSC_SCAN, key);
+	stream_add(stream, EV_KEY, key, !(i & 1));
+	stream_sync(stream);
+}
+
+static void mouse_caps(struct evdev_caps *caps)
+{
+	caps_key(caps, BTN_LEFT);
+	caps_key(caps, BTN_RIGHT);
+	SET_BIT(caps->ev, EV_REL);
+	SET_BIT(caps->rel, REL_X);
+	SET_BIT(caps->rel, REL_Y);
+	SET_BIT(caps->rel, REL_WHEEL);
+}
+
+static void mouse_frame(struct bench_stream *stream, unsigned int i)
+{
+	stream_add(stream, EV_REL, REL_X, (int)(i % 7) - 3);
+	stream_add(stream, EV_REL, REL_Y, (int)(i % 5) - 2);
+	if (i % 64 == 0)
+		stream_add(stream, EV_KEY, BTN_LEFT, !(i & 64));
+	if (i % 100 == 0)
+		stream_add(stream, EV_REL, REL_WHEEL, 1);
+	stream_sync(stream);
+}
+
+static void abs_caps(struct evdev_caps *caps)
+{
+	caps_key(caps, BTN_LEFT);
+	caps_abs(caps, ABS_X, 32767);
+	caps_abs(caps, ABS_Y, 32767);
+}
+
+static void abs_frame(struct bench_stream *stream, unsigned int i)
+{
+	stream_add(stream, EV_ABS, ABS_X, i * 13 % 32768);
+	stream_add(stream, EV_ABS, ABS_Y, i * 7 % 32768);
+	stream_sync(stream);
+}
+
+static void touch_caps(struct evdev_caps *caps)
+{
+	SET_BIT(caps->props, INPUT_PROP_DIRECT);
+	caps_key(caps, BTN_TOUCH);
+	caps_abs(caps, ABS_X, 4095);
+	caps_abs(caps, ABS_Y, 4095);
+	caps_abs(caps, ABS_MT_SLOT, 9);
+	caps_abs(caps, ABS_MT_TRACKING_ID, 65535);
+	caps_abs(caps, ABS_MT_POSITION_X, 4095);
+	caps_abs(caps, ABS_MT_POSITION_Y, 4095);
+}
+
+/* Two fingers moving, lifted and put down again every 200 frames */
+static void touch_frame(struct bench_stream *stream, unsigned int i)
+{
+	unsigned int phase = i % 200;
+	int slot;
+
+	for (slot = 0; slot < 2; slot++) {
+		stream_add(stream, EV_ABS, ABS_MT_SLOT, slot);
+		if (phase == 0)
+			stream_add(stream, EV_ABS, ABS_MT_TRACKING_ID, i + slot);
+		if (phase == 199) {
+			stream_add(stream, EV_ABS, ABS_MT_TRACKING_ID, -1);
+			continue;
+		}
+		stream_add(stream, EV_ABS, ABS_MT_POSITION_X, 1000 + slot * 500 + phase);
+		stream_add(stream, EV_ABS, ABS_MT_POSITION_Y, 1000 + phase * 2);
+	}
+	if (phase == 0 || phase == 199)
+		stream_add(stream, EV_KEY, BTN_TOUCH, phase == 0);
+	stream_add(stream, EV_ABS, ABS_X, 1000 + phase);
+	stream_add(stream, EV_ABS, ABS_Y, 1000 + phase * 2);
+	stream_sync(stream);
+}
+
+static void touchpad_caps(struct evdev_caps *caps)
+{
+	SET_BIT(caps->props, INPUT_PROP_POINTER);
+	caps_key(caps, BTN_LEFT);
+	caps_key(caps, BTN_TOUCH);
+	caps_key(caps, BTN_TOOL_FINGER);
+	caps_key(caps, BTN_TOOL_DOUBLETAP);
+	caps_abs(caps, ABS_X, 6000);
+	caps_abs(caps, ABS_Y, 4000);
+	caps_abs(caps, ABS_PRESSURE, 255);
+}
+
+/* One finger stroke of 100 frames, then a pause of 20 */
+static void touchpad_frame(struct bench_stream *stream, unsigned int i)
+{
+	unsigned int phase = i % 120;
+
+	if (phase == 0) {
+		stream_add(stream, EV_KEY, BTN_TOOL_FINGER, 1);
+		stream_add(stream, EV_KEY, BTN_TOUCH, 1);
+	}
+	if (phase < 100) {
+		stream_add(stream, EV_ABS, ABS_X, 2000 + phase * 20);
+		stream_add(stream, EV_ABS, ABS_Y, 1500 + phase * 10);
+		stream_add(stream, EV_ABS, ABS_PRESSURE, 60);
+	} else if (phase == 100) {
+		stream_add(stream, EV_ABS, ABS_PRESSURE, 0);
+		stream_add(stream, EV_KEY, BTN_TOOL_FINGER, 0);
+		stream_add(stream, EV_KEY, BTN_TOUCH, 0);
+	}
+	stream_sync(stream);
+}
+
+/* Short taps with a pause of 150 frames, longer than the tap timeout,
+ * so each one is also finished by the timer */
+static void tap_frame(struct bench_stream *stream, unsigned int i)
+{
+	unsigned int phase = i % 160;
+
+	if (phase == 0) {
+		stream_add(stream, EV_KEY, BTN_TOOL_FINGER, 1);
+		stream_add(stream, EV_KEY, BTN_TOUCH, 1);
+	}
+	if (phase < 5) {
+		stream_add(stream, EV_ABS, ABS_X, 3000);
+		stream_add(stream, EV_ABS, ABS_Y, 2000);
+		stream_add(stream, EV_ABS, ABS_PRESSURE, 60);
+	} else if (phase == 5) {
+		stream_add(stream, EV_ABS, ABS_PRESSURE, 0);
+		stream_add(stream, EV_KEY, BTN_TOOL_FINGER, 0);
+		stream_add(stream, EV_KEY, BTN_TOUCH, 0);
+	}
+	stream_sync(stream);
+}
+
+static const struct bench_scenario scenarios[] = {
+	{ "keyboard", keyboard_caps, keyboard_frame },
+	{ "rel-mouse", mouse_caps, mouse_frame },
+	{ "abs", abs_caps, abs_frame },
+	{ "mt-touch", touch_caps, touch_frame },
+	{ "touchpad", touchpad_caps, touchpad_frame },
+	{ "touchpad-tap", touchpad_caps, tap_frame },
+};
+
+/* Synthetic streams go through a recording file, exactly like captured
+ * ones, so both are measured on the same replay path. */
+static int write_recording(const struct bench_scenario *scenario,
+		unsigned int frames, char *path)
+{
+	struct yt_record_header header;
+	struct bench_stream stream;
+	unsigned int i;
+	size_t size;
+	int fd, ret = 0;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		fprintf(stderr, "mkstemp: %m\n");
+		return -1;
+	}
+
+	memset(&header, 0, sizeof header);
+	header.magic = YT_RECORD_MAGIC;
+	header.version = YT_RECORD_VERSION;
+	header.header_size = sizeof header;
+	header.event_size = sizeof(struct input_event);
+	header.caps_size = sizeof header.caps;
+	snprintf(header.caps.name, sizeof header.caps.name,
+			"yt_bench %s", scenario->name);
+	header.caps.id.bustype = BUS_VIRTUAL;
+	SET_BIT(header.caps.ev, EV_SYN);
+	scenario->caps(&header.caps);
+
+	memset(&stream, 0, sizeof stream);
+	stream.time = 1000000000;
+	for (i = 0; i < frames; i++)
+		scenario->frame(&stream, i);
+
+	size = stream.count * sizeof *stream.ev;
+	if (write(fd, &header, sizeof header) != sizeof header ||
+			write(fd, stream.ev, size) != (ssize_t)size) {
+		fprintf(stderr, "%s: %m\n", path);
+		ret = -1;
+	}
+
+	free(stream.ev);
+	close(fd);
+	return ret;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(unsigned int p)
+{
+	if (sample_count == 0)
+		return 0;
+	return samples[(sample_count - 1) * p / 100];
+}
+
+static int bench_run(struct yt_seat *seat, const char *name,
+		const char *path, unsigned int runs)
+{
+	struct yt_replay *replay;
+	uint64_t start, elapsed, best = 0;
+	unsigned long run_allocs = 0;
+	unsigned int run;
+	int events = 0;
+
+	sample_count = 0;
+	for (run = 0; run < runs; run++) {
+		/* Opening maps the file and builds the device; not measured */
+		replay = yt_replay_open(path, seat);
+		if (!replay) {
+			fprintf(stderr, "%s: cannot replay %s\n", name, path);
+			return -1;
+		}
+
+		last_frame = 0;
+		allocs = 0;
+		counting = 1;
+		start = bench_now();
+		events = yt_replay_run(replay, YT_REPLAY_FAST);
+		elapsed = bench_now() - start;
+		counting = 0;
+
+		yt_replay_close(replay);
+
+		if (best == 0 || elapsed < best)
+			best = elapsed;
+		if (allocs > run_allocs)
+			run_allocs = allocs;
+	}
+
+	qsort(samples, sample_count, sizeof *samples, compare_u64);
+
+	printf("%-12s %10d %9.2f %9.1f %8llu %8llu %8llu %8llu ",
+			name, events,
+			best ? events * 1000.0 / best : 0.0,
+			events ? (double)best / events : 0.0,
+			(unsigned long long)percentile(50),
+			(unsigned long long)percentile(90),
+			(unsigned long long)percentile(99),
+			(unsigned long long)(sample_count ? samples[sample_count - 1] : 0));
+	if (BENCH_COUNTS_ALLOCS)
+		printf("%7lu\n", run_allocs);
+	else
+		printf("%7s\n", "-");
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n runs] [-f frames] [recording...]\n"
+			"Replays synthetic streams for each dispatch path, or the\n"
+			"given recordings, and reports the best run's throughput\n"
+			"and per-frame cost percentiles over all runs.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct yt_seat *seat;
+	unsigned int runs = BENCH_RUNS, frames = BENCH_FRAMES, i;
+	char path[] = "/tmp/yt_bench.XXXXXX";
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "n:f:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				runs = strtoul(optarg, NULL, 0);
+				break;
+			case 'f':
+				frames = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (runs == 0 || frames == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	seat = yt_seat_create("bench", &notify_api, NULL);
+	if (!seat)
+		return 1;
+
+	/* Recordings may hold many events per frame; one sample per event
+	 * is always enough. */
+	sample_max = (size_t)runs * frames * 8;
+	samples = malloc(sample_max * sizeof *samples);
+	if (!samples)
+		return 1;
+
+	printf("%-12s %10s %9s %9s %8s %8s %8s %8s %7s\n", "stream", "events",
+			"Mev/s", "ns/event", "p50", "p90", "p99", "max", "allocs");
+
+	if (optind < argc) {
+		for (i = optind; i < (unsigned int)argc; i++)
+			if (bench_run(seat, argv[i], argv[i], runs) < 0)
+				ret = 1;
+		return ret;
+	}
+
+	for (i = 0; i < sizeof scenarios / sizeof scenarios[0]; i++) {
+		strcpy(path, "/tmp/yt_bench.XXXXXX");
+		if (write_recording(&scenarios[i], frames, path) < 0)
+			return 1;
+		if (bench_run(seat, scenarios[i].name, path, runs) < 0)
+			ret = 1;
+		unlink(path);
+	}
+
+	return ret;
+}
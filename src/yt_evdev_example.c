@@ -48,23 +48,14 @@ void handle_add(struct yt_device *device, void *data)
 	printf("Device added: %s\n", device->devname);
 	if (strstr(device->devname, name) || alldevices) {
 		int fd_evdev;
-		struct epoll_event ev;
-		ev.events = EPOLLIN;
 		fd_evdev = yt_device_add_to_seat(device, seat);
-		ev.data.ptr = device;
-		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd_evdev, &ev);
-		printf("epoll add fd: %d, device: %s\n", fd_evdev, device->devname);
+		printf("seat add fd: %d, device: %s\n", fd_evdev, device->devname);
 	}
 }
 
 void handle_del(struct yt_device *device, void *data)
 {
 	printf("Device removed: %s\n", device->devname);
-	if (strstr(device->devname, name) || alldevices) {
-		struct epoll_event ev;
-		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, device->fd, &ev);
-		printf("epoll del fd: %d, device: %s\n", device->fd, device->devname);
-	}
 	yt_device_del_from_seat(device, seat);
 }
 
@@ -93,14 +84,21 @@ void axis_cb(struct yt_device *device, void *data, uint32_t time, enum yt_axis_t
 
 void modifier_cb(struct yt_device *device, void *data, uint32_t serial)
 {
-	printf("%s, serial: 0x%x\n", __func__, serial);
+	struct yt_modifiers mods;
+
+	yt_seat_modifiers_get(seat, &mods);
+	printf("%s, serial: 0x%x, depressed: 0x%x, latched: 0x%x, locked: 0x%x, group: %u\n",
+			__func__, serial, mods.depressed, mods.latched,
+			mods.locked, mods.group);
 }
 
 void key_cb(struct yt_device *device, void *data, uint32_t time, uint32_t key,
 			enum yt_key_state state,
 			enum yt_key_state_update update_state)
 {
-	printf("key: %i %s\n", key, state==YT_KEY_STATE_PRESSED?"pressed":"released");
+	printf("key: %i keysym: 0x%x %s\n", key, yt_device_keysym_get(device),
+			state == YT_KEY_STATE_PRESSED ? "pressed" :
+			state == YT_KEY_STATE_REPEAT ? "repeat" : "released");
 }
 
 void touch_cb(struct yt_device *device, void *data, uint32_t time, int touch_id,
@@ -128,7 +126,7 @@ int main(int argc, char *argv[])
 	struct yt_device *device;
 	struct epoll_event ev, events[EPOLL_SIZE];
 
-	int udev_fd, i;
+	int udev_fd;
 	struct wl_list *devlist;
 
 	if (argc != 2) {
@@ -141,6 +139,11 @@ int main(int argc, char *argv[])
 		alldevices = 1;
 
 	seat = yt_seat_create("seat0", &notify_api, NULL);
+	if (!seat)
+		return 1;
+
+	/* Keysyms and modifiers need a keymap; the default one will do */
+	yt_seat_keymap_set(seat, NULL, NULL, NULL, NULL, NULL);
 
 	epoll_fd = epoll_create(128);
 	if (epoll_fd < 0)
@@ -151,9 +154,12 @@ int main(int argc, char *argv[])
 		printf("Failed to init yt_device: %s\n", strerror(errno));
 		return 1;
 	}
+
+	/* The seat covers its devices, timers and the udev monitor, so the
+	 * main loop only has to watch a single fd. */
 	ev.events = EPOLLIN;
-	ev.data.ptr = NULL;
-	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, udev_fd, &ev);
+	ev.data.ptr = seat;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, seat->epoll_fd, &ev);
 
 	devlist = yt_device_get_devices();
 
@@ -161,27 +167,14 @@ int main(int argc, char *argv[])
 		printf("Considering %s\n", device->devname);
 		if (strstr(device->devname, name) || alldevices) {
 			printf("Adding %s\n", device->devname);
-			int fd_evdev;
-			fd_evdev = yt_device_add_to_seat(device, seat);
-			ev.data.ptr = device;
-			epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd_evdev, &ev);
+			yt_device_add_to_seat(device, seat);
 		}
 	}
 
 	while(1) {
 		int n = epoll_wait(epoll_fd, events, EPOLL_SIZE, -1);
-		for (i = 0; i < n; i++)
-		{
-			if (events[i].data.ptr == NULL) {
-				printf("udev event\n");
-				yt_device_hotplug_handle();
-			}
-			else {
-				struct yt_device *dev = events[i].data.ptr;
-				yt_device_handle(dev);
-			}
-
-		}
+		if (n > 0)
+			yt_seat_dispatch(seat, 0);
 	}
 
 	return 0;
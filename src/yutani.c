@@ -19,12 +19,19 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <linux/input.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <mtdev.h>
+#include <sys/epoll.h>
 
 #include <libudev.h>
 #include <wayland-server.h>
@@ -35,6 +42,16 @@
 #include "evdev.h"
 #include "tty.h"
 #include "common.h"
+#include "thread.h"
+#include "record.h"
+#include "replay.h"
+#include "fake.h"
+#ifdef HAVE_LIBURING
+#include "uring.h"
+#endif
+#ifdef HAVE_XKBCOMMON
+#include "xkb.h"
+#endif
 
 #if defined(__GNUC__) && __GNUC__ >= 4
 #define YT_EXPORT __attribute__ ((visibility("default")))
@@ -49,6 +66,13 @@
 #define YT_DEPRECATED
 #endif
 
+/* Size of the notify interface before notify_frame was appended */
+#define YT_SEAT_NOTIFY_SIZE_ORIGINAL \
+	offsetof(struct yt_seat_notify_interface, notify_frame)
+
+/* Upper bound of ready fds drained by one yt_seat_dispatch() call */
+#define YT_SEAT_DISPATCH_MAX 32
+
 struct udev_context *uctx;
 
 struct yt_seat_internal {
@@ -56,8 +80,35 @@ struct yt_seat_internal {
 	struct tty *tty;
 	struct yt_seat_notify_interface notify;
 	void *notify_data;
+
+	struct wl_list link;
+	struct yt_source *hotplug_source;
+	struct yt_source *tty_source;
+	struct yt_source *signal_source;
+	/* Deadlines of all the seat's devices, on a single timerfd */
+	struct yt_timer_wheel *timers;
+	struct yt_source *timer_source;
+	struct evdev_key_repeat repeat;
+	/* Keymap state on the reading side, and the modifiers as of the
+	 * events delivered so far */
+	struct yt_xkb *xkb;
+	struct yt_modifiers modifiers;
+	struct wl_list source_list;
+	/* Sources removed while dispatching, freed once it is done */
+	struct wl_list destroy_list;
+	int dispatching;
+	/* Input thread reading the seat's devices, if one was started */
+	struct yt_thread *thread;
+	struct yt_source *thread_source;
+#ifdef HAVE_LIBURING
+	struct yt_uring *uring;
+	/* Read of the timer wheel's fd, in place of timer_source */
+	struct yt_uring_req *timer_req;
+#endif
 };
 
+static struct wl_list seat_list = { &seat_list, &seat_list };
+
 static inline struct yt_seat_internal *yt_seat_internal(struct yt_seat *seat)
 {
 	return (struct yt_seat_internal *)seat;
@@ -70,13 +121,205 @@ struct yt_seat_notify_interface *yt_seat_notify_get(struct yt_seat *seat, void *
 	return &(yt_seat_internal(seat)->notify);
 }
 
+struct yt_thread *yt_seat_thread_get(struct yt_seat *seat)
+{
+	return yt_seat_internal(seat)->thread;
+}
+
+struct yt_timer_wheel *yt_seat_timers_get(struct yt_seat *seat)
+{
+	return yt_seat_internal(seat)->timers;
+}
+
+struct evdev_key_repeat *yt_seat_key_repeat_get(struct yt_seat *seat)
+{
+	return &yt_seat_internal(seat)->repeat;
+}
+
+struct yt_xkb *yt_seat_xkb_get(struct yt_seat *seat)
+{
+	return yt_seat_internal(seat)->xkb;
+}
+
+struct yt_modifiers *yt_seat_modifiers(struct yt_seat *seat)
+{
+	return &yt_seat_internal(seat)->modifiers;
+}
+
+/* Device reads and their timers go to the input thread when there is one */
+static int yt_seat_source_epoll_fd(struct yt_seat_internal *seat_i,
+		enum yt_source_priority priority)
+{
+	if (seat_i->thread &&
+			(priority == YT_SOURCE_DEVICE || priority == YT_SOURCE_TIMER))
+		return yt_thread_epoll_fd(seat_i->thread);
+	return seat_i->base.epoll_fd;
+}
+
+static int yt_source_epoll_add(struct yt_source *source, int epoll_fd)
+{
+	struct epoll_event ev;
+
+	/* Every handler drains its fd completely, so edge-triggered
+	 * notification is enough and keeps epoll_wait() cheap. */
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = source;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, source->fd, &ev) < 0)
+		return -1;
+
+	source->epoll_fd = epoll_fd;
+	return 0;
+}
+
+static void yt_source_epoll_move(struct yt_source *source, int epoll_fd)
+{
+	if (source->epoll_fd == epoll_fd)
+		return;
+	epoll_ctl(source->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+	if (yt_source_epoll_add(source, epoll_fd) < 0)
+		fprintf(stderr, "failed to move source %d: %m\n", source->fd);
+}
+
+struct yt_source *yt_seat_source_add(struct yt_seat *seat, int fd,
+		enum yt_source_priority priority, yt_source_func_t func, void *data)
+{
+	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
+	struct yt_source *source;
+
+	source = malloc(sizeof *source);
+	if (source == NULL)
+		return NULL;
+
+	source->fd = fd;
+	source->priority = priority;
+	source->func = func;
+	source->data = data;
+
+	if (yt_source_epoll_add(source,
+				yt_seat_source_epoll_fd(seat_i, priority)) < 0) {
+		free(source);
+		return NULL;
+	}
+	wl_list_insert(&seat_i->source_list, &source->link);
+
+	return source;
+}
+
+void yt_seat_source_remove(struct yt_seat *seat, struct yt_source *source)
+{
+	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
+
+	if (source == NULL)
+		return;
+
+	epoll_ctl(source->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+	source->fd = -1;
+	wl_list_remove(&source->link);
+
+	/* The source may still be referenced by the batch being dispatched,
+	 * on either thread. */
+	if (seat_i->thread && source->epoll_fd != seat->epoll_fd)
+		yt_thread_release_source(seat_i->thread, source);
+	else if (seat_i->dispatching)
+		wl_list_insert(&seat_i->destroy_list, &source->link);
+	else
+		free(source);
+}
+
+static int yt_hotplug_source_handler(int fd, uint32_t mask, void *data)
+{
+	/* The monitor is edge-triggered, keep receiving until it is empty. */
+	while (evdev_udev_handler(fd, mask, data) == 0)
+		;
+
+	return 1;
+}
+
+static void yt_seat_hotplug_attach(struct yt_seat_internal *seat_i)
+{
+	if (seat_i->hotplug_source || !uctx || !uctx->udev_monitor)
+		return;
+
+	seat_i->hotplug_source = yt_seat_source_add(&seat_i->base,
+			uctx->udev_fd, YT_SOURCE_HOTPLUG,
+			yt_hotplug_source_handler, uctx);
+}
+
+#ifdef HAVE_LIBURING
+/* The seat's ring, created on first use. If io_uring turns out to be
+ * unavailable the whole context drops back to the epoll backend. */
+static struct yt_uring *yt_seat_uring(struct yt_seat_internal *seat_i)
+{
+	if (!uctx || uctx->io_backend != YT_IO_BACKEND_IO_URING)
+		return NULL;
+
+	if (!seat_i->uring) {
+		seat_i->uring = yt_uring_create(&seat_i->base);
+		if (!seat_i->uring) {
+			fprintf(stderr, "io_uring unavailable, using epoll\n");
+			uctx->io_backend = YT_IO_BACKEND_EPOLL;
+			return NULL;
+		}
+
+		/* Expirations are reaped with the device reads. The wheel
+		 * stays on epoll if the read cannot be posted. */
+		seat_i->timer_req = yt_uring_add_timer(seat_i->uring,
+				seat_i->timers);
+		if (seat_i->timer_req) {
+			yt_seat_source_remove(&seat_i->base,
+					seat_i->timer_source);
+			seat_i->timer_source = NULL;
+		}
+	}
+
+	return seat_i->uring;
+}
+
+void yt_device_uring_fallback(struct evdev_device *dev)
+{
+	dev->uring_req = NULL;
+	dev->source = yt_seat_source_add(dev->seat, dev->base.fd,
+			YT_SOURCE_DEVICE, evdev_device_data, dev);
+	if (!dev->source)
+		fprintf(stderr, "%s: no longer read\n", dev->base.devnode);
+}
+
+void yt_seat_timers_uring_fallback(struct yt_seat *seat)
+{
+	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
+
+	seat_i->timer_req = NULL;
+	seat_i->timer_source = yt_seat_source_add(seat,
+			yt_timer_wheel_fd(seat_i->timers), YT_SOURCE_TIMER,
+			yt_timer_wheel_handler, seat_i->timers);
+	if (!seat_i->timer_source)
+		fprintf(stderr, "seat %s: timeouts no longer run\n", seat->name);
+}
+#endif
+
 YT_EXPORT int yt_device_init(struct yt_hotplug_cbs *plug, void *data)
 {
+	return yt_device_init_backend(plug, data, YT_IO_BACKEND_EPOLL);
+}
+
+YT_EXPORT int yt_device_init_backend(struct yt_hotplug_cbs *plug, void *data,
+		enum yt_io_backend backend)
+{
+	struct yt_seat_internal *seat_i;
 	int fd;
 
 	uctx = calloc(1, sizeof(struct udev_context));
 	wl_list_init(&uctx->devices_list);
 
+#ifdef HAVE_LIBURING
+	uctx->io_backend = backend;
+#else
+	if (backend != YT_IO_BACKEND_EPOLL)
+		fprintf(stderr, "built without io_uring, using epoll\n");
+	uctx->io_backend = YT_IO_BACKEND_EPOLL;
+#endif
+
 	if (plug)
 		uctx->hotplug_cb = *plug;
 	uctx->hotplug_data = data;
@@ -85,6 +328,9 @@ YT_EXPORT int yt_device_init(struct yt_hotplug_cbs *plug, void *data)
 
 	evdev_add_devices(uctx);
 
+	wl_list_for_each(seat_i, &seat_list, link)
+		yt_seat_hotplug_attach(seat_i);
+
 	return fd;
 }
 
@@ -101,12 +347,36 @@ YT_EXPORT struct wl_list *yt_device_get_devices()
 YT_EXPORT int yt_device_add_to_seat(struct yt_device *device, struct yt_seat *seat)
 {
 	struct evdev_device *dev = evdev_device(device);
-	dev->seat = seat;
-	device->fd = open(device->devnode, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	struct yt_thread *thread = yt_seat_internal(seat)->thread;
+
+	if (thread)
+		yt_thread_lock(thread);
+	evdev_device_set_seat(dev, seat);
+	if (dev->fake)
+		device->fd = fake_device_open(dev);
+	else
+		device->fd = open(device->devnode, O_RDWR | O_NONBLOCK | O_CLOEXEC);
 	if (!(device->fd < 0))
 	{
+		/* A pipe has no evdev ioctls to set up */
+		if (!dev->fake)
+			evdev_device_setup_fd(dev);
 		wl_list_insert(&seat->devices, &device->seat_link);
+
+#ifdef HAVE_LIBURING
+		/* mtdev reads the fd itself, so those devices stay on epoll */
+		struct yt_uring *uring = NULL;
+		if (!thread)
+			uring = yt_seat_uring(yt_seat_internal(seat));
+		if (uring && !dev->mtdev)
+			dev->uring_req = yt_uring_add_device(uring, dev);
+#endif
+		if (!dev->uring_req)
+			dev->source = yt_seat_source_add(seat, device->fd,
+					YT_SOURCE_DEVICE, evdev_device_data, dev);
 	}
+	if (thread)
+		yt_thread_unlock(thread);
 
 	return device->fd;
 }
@@ -114,13 +384,33 @@ YT_EXPORT int yt_device_add_to_seat(struct yt_device *device, struct yt_seat *se
 YT_EXPORT int yt_device_del_from_seat(struct yt_device *device, struct yt_seat *seat __UNUSED__)
 {
 	struct evdev_device *dev = evdev_device(device);
+	struct yt_thread *thread = NULL;
+
+	if (dev->seat)
+		thread = yt_seat_internal(dev->seat)->thread;
+	if (thread)
+		yt_thread_lock(thread);
 	if (!(device->fd < 0))
 	{
+		yt_seat_source_remove(dev->seat, dev->source);
+		dev->source = NULL;
+#ifdef HAVE_LIBURING
+		yt_uring_remove(yt_seat_internal(dev->seat)->uring, dev->uring_req);
+#endif
+		dev->uring_req = NULL;
+
 		wl_list_remove(&device->seat_link);
 		close(device->fd);
 		device->fd = -1;
 	}
-	dev->seat = NULL;
+	/* The input thread runs the seat's timer wheel, so the device's
+	 * timer is cancelled before it lets go of the lock */
+	dev->frame.count = 0;
+	evdev_device_set_seat(dev, NULL);
+	if (thread) {
+		yt_thread_forget_device(thread, dev);
+		yt_thread_unlock(thread);
+	}
 	return 0;
 }
 
@@ -129,14 +419,22 @@ YT_EXPORT int yt_device_handle(struct yt_device *device)
 	return evdev_device_data(device->fd, 0, device);
 }
 
-YT_EXPORT int yt_device_timer_handle(struct yt_device *device)
+/* Device timers are on the seat's epoll fd now and timer_fd stays -1.
+ * Kept for callers that still use it; it runs whatever is due, unless an
+ * input thread does that already. */
+YT_EXPORT YT_DEPRECATED int yt_device_timer_handle(struct yt_device *device)
 {
 	struct evdev_device *dev = evdev_device(device);
-	return touchpad_timeout_handler((struct evdev_device *)dev->dispatch);
+
+	if (dev->timers && !yt_seat_internal(dev->seat)->thread)
+		yt_timer_wheel_run(dev->timers, yt_timer_wheel_now(dev->timers));
+
+	return 1;
 }
 
-YT_EXPORT struct yt_seat *yt_seat_create(const char *name,
-		struct yt_seat_notify_interface *notify, void *data)
+YT_EXPORT struct yt_seat *yt_seat_create_sized(const char *name,
+		const struct yt_seat_notify_interface *notify, size_t size,
+		void *data)
 {
 	if (!name)
 		return NULL;
@@ -149,18 +447,238 @@ YT_EXPORT struct yt_seat *yt_seat_create(const char *name,
 
 	wl_list_init(&seat->base.devices);
 
+	/* Members the caller's struct lacks stay NULL */
 	if (notify)
-		memcpy(&seat->notify, notify, sizeof(struct yt_seat_notify_interface));
+		memcpy(&seat->notify, notify, size < sizeof seat->notify ?
+				size : sizeof seat->notify);
 
 	seat->notify_data = data;
 
 	seat->tty = NULL;
 	seat->base.tty_event_fd = -1;
 	seat->base.tty_signal_fd = -1;
-//	seat->epoll_fd = epoll_create(128); 
+	seat->base.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (seat->base.epoll_fd < 0) {
+		free(seat->base.name);
+		free(seat);
+		return NULL;
+	}
+
+	wl_list_init(&seat->source_list);
+	wl_list_init(&seat->destroy_list);
+	evdev_key_repeat_init(&seat->repeat);
+#ifdef HAVE_XKBCOMMON
+	/* Devices cache it when they join, so it is there before a keymap */
+	seat->xkb = yt_xkb_create();
+#endif
+
+	seat->timers = yt_timer_wheel_create();
+	if (seat->timers)
+		seat->timer_source = yt_seat_source_add(&seat->base,
+				yt_timer_wheel_fd(seat->timers), YT_SOURCE_TIMER,
+				yt_timer_wheel_handler, seat->timers);
+	if (!seat->timer_source) {
+		yt_timer_wheel_destroy(seat->timers);
+		close(seat->base.epoll_fd);
+		free(seat->base.name);
+		free(seat);
+		return NULL;
+	}
+
+	wl_list_insert(&seat_list, &seat->link);
+	yt_seat_hotplug_attach(seat);
+
 	return (struct yt_seat *)seat;
 }
 
+/* The entry point of binaries built before the interface grew, whose
+ * struct ends after notify_touch. The header maps the name to
+ * yt_seat_create_sized() for everyone else. */
+YT_EXPORT struct yt_seat *(yt_seat_create)(const char *name,
+		struct yt_seat_notify_interface *notify, void *data)
+{
+	return yt_seat_create_sized(name, notify,
+			YT_SEAT_NOTIFY_SIZE_ORIGINAL, data);
+}
+
+/* Drain up to budget ready fds of the seat without blocking. VT switches
+ * go first, then device input and timers, and hotplug last so that a
+ * removed device is never read after it was destroyed. */
+YT_EXPORT int yt_seat_dispatch(struct yt_seat *seat, int budget)
+{
+	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
+	struct epoll_event ep[YT_SEAT_DISPATCH_MAX];
+	struct yt_source *source, *next;
+	int count, i, priority;
+
+	if (budget <= 0 || budget > YT_SEAT_DISPATCH_MAX)
+		budget = YT_SEAT_DISPATCH_MAX;
+
+	count = epoll_wait(seat->epoll_fd, ep, budget, 0);
+	if (count < 0)
+		return errno == EINTR ? 0 : -1;
+
+	seat_i->dispatching = 1;
+	for (priority = 0; priority < YT_SOURCE_PRIORITY_COUNT; priority++) {
+		for (i = 0; i < count; i++) {
+			source = ep[i].data.ptr;
+			if (source->priority != (enum yt_source_priority)priority ||
+					source->fd < 0)
+				continue;
+			source->func(source->fd, ep[i].events, source->data);
+		}
+	}
+	seat_i->dispatching = 0;
+
+	wl_list_for_each_safe(source, next, &seat_i->destroy_list, link)
+		free(source);
+	wl_list_init(&seat_i->destroy_list);
+
+	return count;
+}
+
+/* Move device reads and timers of the seat to a thread of their own. Events
+ * are queued there and delivered from yt_seat_dispatch() on the compositor
+ * thread, which must no longer call yt_device_handle() itself. */
+YT_EXPORT int yt_seat_thread_start(struct yt_seat *seat,
+		const struct yt_seat_thread_config *config)
+{
+	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
+	struct yt_thread *thread;
+	struct yt_source *source;
+
+	if (seat_i->thread)
+		return 0;
+	if (seat_i->dispatching)
+		return -1;
+#ifdef HAVE_LIBURING
+	if (seat_i->uring) {
+		fprintf(stderr, "input thread needs the epoll backend\n");
+		return -1;
+	}
+#endif
+
+	thread = yt_thread_create(config);
+	if (!thread)
+		return -1;
+
+	seat_i->thread_source = yt_seat_source_add(seat,
+			yt_thread_event_fd(thread), YT_SOURCE_QUEUE,
+			yt_thread_drain, thread);
+	if (!seat_i->thread_source) {
+		yt_thread_destroy(thread);
+		return -1;
+	}
+
+	seat_i->thread = thread;
+	wl_list_for_each(source, &seat_i->source_list, link)
+		yt_source_epoll_move(source,
+				yt_seat_source_epoll_fd(seat_i, source->priority));
+
+	if (yt_thread_start(thread) < 0) {
+		yt_seat_thread_stop(seat);
+		return -1;
+	}
+
+	return 0;
+}
+
+YT_EXPORT void yt_seat_thread_stop(struct yt_seat *seat)
+{
+	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
+	struct yt_thread *thread = seat_i->thread;
+	struct yt_source *source;
+
+	if (!thread)
+		return;
+
+	/* Joins the thread, so nothing is dispatched there from now on */
+	yt_thread_stop(thread);
+	seat_i->thread = NULL;
+
+	yt_seat_source_remove(seat, seat_i->thread_source);
+	seat_i->thread_source = NULL;
+
+	wl_list_for_each(source, &seat_i->source_list, link)
+		yt_source_epoll_move(source, seat->epoll_fd);
+
+	yt_thread_destroy(thread);
+}
+
+/* Repeat the last key pressed on the seat rate times a second once it has
+ * been held for delay milliseconds. A rate of 0, the default, turns it
+ * off. */
+YT_EXPORT int yt_seat_key_repeat_set(struct yt_seat *seat, int32_t rate, int32_t delay)
+{
+	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
+	struct yt_thread *thread = seat_i->thread;
+
+	if (rate < 0 || delay < 0)
+		return -1;
+
+	if (thread)
+		yt_thread_lock(thread);
+	evdev_key_repeat_stop(&seat_i->repeat);
+	seat_i->repeat.delay = delay * 1000000ULL;
+	seat_i->repeat.period = rate ? 1000000000ULL / rate : 0;
+	if (thread)
+		yt_thread_unlock(thread);
+
+	return 0;
+}
+
+/* Compile a keymap from RMLVO names, NULL ones taking the defaults. From
+ * then on key events carry keysyms and modifier changes are notified. */
+YT_EXPORT int yt_seat_keymap_set(struct yt_seat *seat __UNUSED__,
+		const char *rules __UNUSED__, const char *model __UNUSED__,
+		const char *layout __UNUSED__, const char *variant __UNUSED__,
+		const char *options __UNUSED__)
+{
+#ifdef HAVE_XKBCOMMON
+	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
+	struct yt_thread *thread = seat_i->thread;
+	struct xkb_rule_names names = { rules, model, layout, variant, options };
+	struct yt_modifiers modifiers;
+	int ret;
+
+	if (!seat_i->xkb)
+		return -1;
+
+	/* The old keymap's modifiers no longer apply to anything, so
+	 * yt_seat_modifiers_get() drops them along with it */
+	if (thread)
+		yt_thread_lock(thread);
+	ret = yt_xkb_keymap_set(seat_i->xkb, &names, &modifiers);
+	if (ret == 0)
+		seat_i->modifiers = modifiers;
+	if (thread)
+		yt_thread_unlock(thread);
+
+	return ret;
+#else
+	fprintf(stderr, "built without xkbcommon, no keymap\n");
+	return -1;
+#endif
+}
+
+/* The keymap in text form for wl_keyboard.keymap, to be freed by the
+ * caller. NULL if none was set. */
+YT_EXPORT char *yt_seat_keymap_get_string(struct yt_seat *seat __UNUSED__)
+{
+#ifdef HAVE_XKBCOMMON
+	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
+
+	if (seat_i->xkb)
+		return yt_xkb_keymap_get_string(seat_i->xkb);
+#endif
+	return NULL;
+}
+
+YT_EXPORT void yt_seat_modifiers_get(struct yt_seat *seat, struct yt_modifiers *modifiers)
+{
+	*modifiers = yt_seat_internal(seat)->modifiers;
+}
+
 YT_EXPORT void yt_device_user_data_set(struct yt_device *device, void *user_data)
 {
 	struct evdev_device *dev = evdev_device(device);
@@ -173,6 +691,198 @@ YT_EXPORT void *yt_device_user_data_get(struct yt_device *device)
 	return dev->user_data;
 }
 
+/* For the per-event callbacks: the full resolution timestamp of the event
+ * they are being called for. */
+YT_EXPORT uint64_t yt_device_time_ns_get(struct yt_device *device)
+{
+	struct evdev_device *dev = evdev_device(device);
+	return dev->time_ns;
+}
+
+/* Keysym of the key event being delivered, 0 without a keymap */
+YT_EXPORT uint32_t yt_device_keysym_get(struct yt_device *device)
+{
+	struct evdev_device *dev = evdev_device(device);
+	return dev->keysym;
+}
+
+/* Latencies are recorded where the callbacks run, so read them from
+ * there too. */
+YT_EXPORT void yt_device_latency_get(struct yt_device *device,
+		struct yt_latency *latency)
+{
+	struct evdev_device *dev = evdev_device(device);
+	*latency = dev->latency;
+}
+
+YT_EXPORT void yt_device_latency_reset(struct yt_device *device)
+{
+	struct evdev_device *dev = evdev_device(device);
+	memset(&dev->latency, 0, sizeof dev->latency);
+}
+
+/* Counters are plain increments on the dispatching thread; with an input
+ * thread running a copy may be slightly out of date. */
+YT_EXPORT void yt_device_stats_get(struct yt_device *device,
+		struct yt_device_stats *stats)
+{
+	struct evdev_device *dev = evdev_device(device);
+
+	*stats = dev->stats;
+	stats->motion_coalesced = dev->motion_samples > dev->motion_notified ?
+		dev->motion_samples - dev->motion_notified : 0;
+}
+
+YT_EXPORT uint64_t yt_latency_bucket_ns(unsigned int bucket)
+{
+	unsigned int msb;
+
+	if (bucket < 2 * YT_LATENCY_SUB_BUCKETS)
+		return bucket;
+
+	msb = bucket / YT_LATENCY_SUB_BUCKETS + 1;
+	return (uint64_t)(YT_LATENCY_SUB_BUCKETS + bucket % YT_LATENCY_SUB_BUCKETS)
+		<< (msb - 2);
+}
+
+/* Keep the input thread away while a device is reconfigured */
+static struct yt_thread *yt_device_lock(struct evdev_device *dev)
+{
+	struct yt_thread *thread = NULL;
+
+	if (dev->seat)
+		thread = yt_seat_internal(dev->seat)->thread;
+	if (thread)
+		yt_thread_lock(thread);
+	return thread;
+}
+
+YT_EXPORT int yt_device_accel_set(struct yt_device *device,
+		enum yt_accel_profile profile, double speed)
+{
+	struct evdev_device *dev = evdev_device(device);
+	struct yt_thread *thread;
+	int ret;
+
+	thread = yt_device_lock(dev);
+	ret = evdev_device_accel_set(dev, profile, speed);
+	if (thread)
+		yt_thread_unlock(thread);
+
+	return ret;
+}
+
+/* Touchpads only: how many positions motion is estimated from, and how
+ * much it is smoothed, see touchpad_motion_configure(). */
+YT_EXPORT int yt_device_touchpad_motion_set(struct yt_device *device,
+		unsigned int history_length, unsigned int smoothing)
+{
+	struct evdev_device *dev = evdev_device(device);
+	struct yt_thread *thread;
+	int ret;
+
+	thread = yt_device_lock(dev);
+	ret = touchpad_motion_configure(dev, history_length, smoothing);
+	if (thread)
+		yt_thread_unlock(thread);
+
+	return ret;
+}
+
+/* Save everything read from the device from now on to path, together
+ * with its capabilities, for later analysis or replay. */
+YT_EXPORT int yt_device_record_start(struct yt_device *device, const char *path)
+{
+	struct evdev_device *dev = evdev_device(device);
+	struct yt_recorder *recorder;
+	struct yt_thread *thread;
+
+	if (dev->recorder)
+		return -1;
+
+	recorder = yt_recorder_create(path, &dev->caps,
+			dev->mtdev ? YT_RECORD_MTDEV : 0);
+	if (!recorder)
+		return -1;
+
+	thread = yt_device_lock(dev);
+	dev->recorder = recorder;
+	if (thread)
+		yt_thread_unlock(thread);
+
+	return 0;
+}
+
+YT_EXPORT void yt_device_record_stop(struct yt_device *device)
+{
+	struct evdev_device *dev = evdev_device(device);
+	struct yt_recorder *recorder;
+	struct yt_thread *thread;
+
+	thread = yt_device_lock(dev);
+	recorder = dev->recorder;
+	dev->recorder = NULL;
+	if (thread)
+		yt_thread_unlock(thread);
+
+	yt_recorder_destroy(recorder);
+}
+
+/* Override the kernel-side filter of a single event code. Codes of types
+ * the filter does not cover are always delivered. */
+YT_EXPORT int yt_device_event_mask_set(struct yt_device *device, unsigned int type,
+		unsigned int code, int enable)
+{
+	struct evdev_device *dev = evdev_device(device);
+	struct yt_thread *thread;
+	unsigned long *codes;
+	unsigned int count;
+	int ret;
+
+	switch (type) {
+		case EV_KEY:
+			codes = dev->mask.key;
+			count = KEY_CNT;
+			break;
+		case EV_REL:
+			codes = dev->mask.rel;
+			count = REL_CNT;
+			break;
+		case EV_ABS:
+			codes = dev->mask.abs;
+			count = ABS_CNT;
+			break;
+		case EV_MSC:
+			codes = dev->mask.msc;
+			count = MSC_CNT;
+			break;
+		case EV_SW:
+			codes = dev->mask.sw;
+			count = SW_CNT;
+			break;
+		default:
+			return -1;
+	}
+	if (code >= count)
+		return -1;
+
+	/* The input thread reads the mask when it resyncs */
+	thread = yt_device_lock(dev);
+	if (!dev->mask.enabled) {
+		ret = -1;
+	} else {
+		if (enable)
+			SET_BIT(codes, code);
+		else
+			CLEAR_BIT(codes, code);
+		ret = evdev_device_install_mask(dev);
+	}
+	if (thread)
+		yt_thread_unlock(thread);
+
+	return ret;
+}
+
 YT_EXPORT void yt_device_leds_state_set(struct yt_device *device, enum yt_led_state state)
 {
 	struct evdev_device *dev = evdev_device(device);
@@ -189,6 +899,54 @@ YT_EXPORT enum yt_led_state yt_seat_leds_state_get(struct yt_device *device)
 	return dev->led_state;
 }
 
+/* A device without a kernel node. It is added to seats and handled like
+ * any other, and reads whatever is passed to yt_fake_device_write(). */
+YT_EXPORT struct yt_device *yt_fake_device_create(const struct yt_fake_desc *desc)
+{
+	struct evdev_device *dev;
+
+	if (!desc)
+		return NULL;
+	dev = fake_device_create(desc);
+	return dev ? &dev->base : NULL;
+}
+
+YT_EXPORT int yt_fake_device_write(struct yt_device *device,
+		const struct input_event *ev, int count)
+{
+	return fake_device_write(evdev_device(device), ev, count);
+}
+
+YT_EXPORT void yt_fake_device_destroy(struct yt_device *device)
+{
+	fake_device_destroy(evdev_device(device));
+}
+
+/* Replay a recording through the dispatch, delivering to the seat's
+ * callbacks on the calling thread. The seat must not run an input thread.
+ * Timeouts of the replayed device go by the recorded timestamps. */
+YT_EXPORT struct yt_replay *yt_replay_open(const char *path, struct yt_seat *seat)
+{
+	if (!path || !seat)
+		return NULL;
+	return replay_open(path, seat);
+}
+
+YT_EXPORT int yt_replay_run(struct yt_replay *replay, enum yt_replay_mode mode)
+{
+	return replay_run(replay, mode);
+}
+
+YT_EXPORT struct yt_device *yt_replay_device_get(struct yt_replay *replay)
+{
+	return replay_device_get(replay);
+}
+
+YT_EXPORT void yt_replay_close(struct yt_replay *replay)
+{
+	replay_close(replay);
+}
+
 YT_EXPORT int yt_tty_create(struct yt_seat *seat, int tty_fd, int tty_nr, yt_tty_vt_func_t vt_func, void *data)
 {
 	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
@@ -197,6 +955,14 @@ YT_EXPORT int yt_tty_create(struct yt_seat *seat, int tty_fd, int tty_nr, yt_tty
 		seat_i->tty = tty;
 		seat_i->base.tty_event_fd = tty_event_fd_get(tty);
 		seat_i->base.tty_signal_fd = tty_signal_fd_get(tty);
+		seat_i->tty_source = yt_seat_source_add(seat,
+				seat_i->base.tty_event_fd, YT_SOURCE_TTY,
+				on_tty_input, tty);
+		/* Not on the io_uring ring even when there is one: VT switches
+		 * have to be handled ahead of any pending input. */
+		seat_i->signal_source = yt_seat_source_add(seat,
+				seat_i->base.tty_signal_fd, YT_SOURCE_SIGNAL,
+				tty_signal_handler, tty);
 		return 1;
 	}
 	return 0;
@@ -214,13 +980,17 @@ YT_EXPORT int yt_tty_signal_handle(struct yt_seat *seat)
 {
 	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
 	if (seat_i->tty)
-		return tty_vt_handler(0, seat_i->tty);
+		return tty_signal_handler(seat->tty_signal_fd, 0, seat_i->tty);
 	return 0;
 }
 
 YT_EXPORT void yt_tty_destroy(struct yt_seat *seat)
 {
 	struct yt_seat_internal *seat_i = yt_seat_internal(seat);
+	yt_seat_source_remove(seat, seat_i->tty_source);
+	yt_seat_source_remove(seat, seat_i->signal_source);
+	seat_i->tty_source = NULL;
+	seat_i->signal_source = NULL;
 	if (seat_i->tty)
 		tty_destroy(seat_i->tty);
 	seat_i->tty = NULL;
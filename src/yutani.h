@@ -50,7 +50,9 @@ enum yt_button_state {
 
 enum yt_key_state {
 	YT_KEY_STATE_PRESSED,
-	YT_KEY_STATE_RELEASED
+	YT_KEY_STATE_RELEASED,
+	/* Generated while a key is held, see yt_seat_key_repeat_set() */
+	YT_KEY_STATE_REPEAT
 };
 
 enum yt_touch_state {
@@ -76,9 +78,69 @@ struct yt_device {
 	char *devnode;
 	char *devname;
 	int fd;
+	/* Always -1, device timers are dispatched with the seat */
 	int timer_fd;
 };
 
+enum yt_event_type {
+	YT_EVENT_MOTION,
+	YT_EVENT_MOTION_ABSOLUTE,
+	YT_EVENT_BUTTON,
+	YT_EVENT_AXIS,
+	YT_EVENT_KEY,
+	YT_EVENT_TOUCH,
+	YT_EVENT_TOUCH_FRAME,
+	YT_EVENT_MODIFIERS
+};
+
+/* Serialized xkb modifier state of a seat, see yt_seat_keymap_set() */
+struct yt_modifiers {
+	/* Bumped on every change */
+	uint32_t serial;
+	uint32_t depressed;
+	uint32_t latched;
+	uint32_t locked;
+	uint32_t group;
+};
+
+/* One coalesced event of a frame handed to notify_frame. */
+struct yt_event {
+	enum yt_event_type type;
+	/* Milliseconds, as passed to the per-event callbacks */
+	uint32_t time;
+	/* CLOCK_MONOTONIC nanoseconds */
+	uint64_t time_ns;
+	union {
+		struct {
+			wl_fixed_t dx, dy;
+		} motion;
+		struct {
+			wl_fixed_t x, y;
+		} motion_absolute;
+		struct {
+			int32_t button;
+			enum yt_button_state state;
+		} button;
+		struct {
+			enum yt_axis_type axis;
+			wl_fixed_t value;
+		} axis;
+		struct {
+			uint32_t key;
+			enum yt_key_state state;
+			enum yt_key_state_update update_state;
+			/* xkb keysym, 0 without a keymap */
+			uint32_t keysym;
+		} key;
+		struct {
+			int touch_id;
+			wl_fixed_t x, y;
+			enum yt_touch_state state;
+		} touch;
+		struct yt_modifiers modifiers;
+	};
+};
+
 struct yt_seat_notify_interface {
 	void (*notify_motion)(struct yt_device *device, void *notify_data, uint32_t time,
 			wl_fixed_t dx, wl_fixed_t dy);
@@ -88,11 +150,24 @@ struct yt_seat_notify_interface {
 			enum yt_button_state state);
 	void (*notify_axis)(struct yt_device *device, void *notify_data, uint32_t time, enum yt_axis_type axis,
 			wl_fixed_t value);
+	/* Sent when a key changed the modifiers of the seat, whose state is
+	 * then read with yt_seat_modifiers_get(). */
 	void (*notify_modifiers)(struct yt_device *device, void *notify_data, uint32_t serial);
 	void (*notify_key)(struct yt_device *device, void *notify_data, uint32_t time, uint32_t key,
 			enum yt_key_state state, enum yt_key_state_update update_state);
 	void (*notify_touch)(struct yt_device *device, void *notify_data, uint32_t time, int touch_id,
 			wl_fixed_t x, wl_fixed_t y, enum yt_touch_state state);
+	/* Members from here on are only read when the caller passed a
+	 * large enough size, see yt_seat_create_sized(). */
+
+	/* Optional. When set, the events of each SYN_REPORT frame are
+	 * delivered here as one array instead of through the callbacks
+	 * above. */
+	void (*notify_frame)(struct yt_device *device, void *notify_data,
+			const struct yt_event *events, int count);
+	/* Sent after all touch points that changed in one frame. */
+	void (*notify_touch_frame)(struct yt_device *device, void *notify_data,
+			uint32_t time);
 };
 
 struct yt_seat {
@@ -100,14 +175,114 @@ struct yt_seat {
 	struct wl_list devices;
 	int tty_event_fd;
 	int tty_signal_fd;
+	/* Covers every fd of the seat, see yt_seat_dispatch() */
+	int epoll_fd;
+};
+
+enum yt_io_backend {
+	YT_IO_BACKEND_EPOLL,
+	/* Keeps a read posted on every device fd of a seat and on its
+	 * timer fd, and reaps completions in batches. VT switch signals
+	 * stay on epoll. Falls back to epoll when io_uring is
+	 * unavailable. */
+	YT_IO_BACKEND_IO_URING
+};
+
+struct yt_seat_thread_config {
+	/* SCHED_FIFO priority of the input thread, 0 keeps SCHED_OTHER */
+	int priority;
+	/* CPUs the input thread may run on, 0 for no restriction */
+	uint64_t cpu_mask;
+	/* Events buffered for the compositor, rounded up to a power of two */
+	unsigned int queue_size;
+};
+
+/* Either way timeouts, such as the tap timeout, run on the recorded
+ * clock, so both modes deliver the same events. */
+enum yt_replay_mode {
+	/* Keep the recorded spacing between frames */
+	YT_REPLAY_REALTIME,
+	/* Feed frames back to back */
+	YT_REPLAY_FAST
+};
+
+/* Acceleration of relative pointer motion. ADAPTIVE scales motion by
+ * its velocity, FLAT by a constant; both are on by default. */
+enum yt_accel_profile {
+	YT_ACCEL_PROFILE_NONE,
+	YT_ACCEL_PROFILE_FLAT,
+	YT_ACCEL_PROFILE_ADAPTIVE
+};
+
+/* Latency from the kernel timestamp of an event to the moment its
+ * callback was called, in log-linear buckets: values below 8ns have a
+ * bucket each, above that every power of two is split into
+ * YT_LATENCY_SUB_BUCKETS equal parts. yt_latency_bucket_ns() gives the
+ * lower bound of a bucket. Replayed devices keep the recorded timestamps,
+ * so their latencies mean nothing. */
+#define YT_LATENCY_SUB_BUCKETS 4
+#define YT_LATENCY_BUCKETS (63 * YT_LATENCY_SUB_BUCKETS)
+
+struct yt_latency {
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t max_ns;
+	uint32_t buckets[YT_LATENCY_BUCKETS];
+};
+
+/* Running totals kept by each device, see yt_device_stats_get(). */
+struct yt_device_stats {
+	/* read() or mtdev_get() calls, or reads completed on the io_uring
+	 * ring, and those that failed */
+	uint64_t syscalls;
+	uint64_t read_errors;
+	/* Of those, the ones that went through mtdev */
+	uint64_t mtdev_reads;
+	uint64_t events_read;
+	/* Read but ignored by the device's dispatch */
+	uint64_t events_dropped;
+	/* Thrown away after SYN_DROPPED, up to the resync */
+	uint64_t events_desynced;
+	uint64_t syn_frames;
+	uint64_t callbacks;
+	/* Motion samples, one per frame for each axis pair or moved
+	 * touch, that did not get a notification of their own */
+	uint64_t motion_coalesced;
+};
+
+struct yt_replay;
+
+struct yt_fake_axis {
+	uint16_t code;
+	int32_t minimum;
+	int32_t maximum;
+};
+
+/* Capabilities of a device that only exists in memory */
+struct yt_fake_desc {
+	const char *name;
+	uint16_t vendor;
+	uint16_t product;
+	const uint16_t *props;
+	int nprops;
+	const uint16_t *keys;
+	int nkeys;
+	const uint16_t *rels;
+	int nrels;
+	const struct yt_fake_axis *axes;
+	int naxes;
 };
 
+struct input_event;
+
 struct yt_hotplug_cbs {
 	void (*add_cb)(struct yt_device *dev, void *data);
 	void (*del_cb)(struct yt_device *dev, void *data);
 };
 
 int yt_device_init(struct yt_hotplug_cbs *plug, void *data);
+int yt_device_init_backend(struct yt_hotplug_cbs *plug, void *data,
+		enum yt_io_backend backend);
 struct wl_list *yt_device_get_devices();
 int yt_device_add_to_seat(struct yt_device *device, struct yt_seat *seat);
 int yt_device_del_from_seat(struct yt_device *device, struct yt_seat *seat);
@@ -115,11 +290,53 @@ int yt_device_handle(struct yt_device *device);
 int yt_device_timer_handle(struct yt_device *device);
 struct yt_seat *yt_seat_create(const char *name,
 		struct yt_seat_notify_interface *notify, void *data);
+/* size is that of the caller's struct yt_seat_notify_interface, so that
+ * members appended to it later are only read from callers that have
+ * them. yt_seat_create() passes it for code built against this header;
+ * older binaries calling the function get the original members only. */
+struct yt_seat *yt_seat_create_sized(const char *name,
+		const struct yt_seat_notify_interface *notify, size_t size,
+		void *data);
+#define yt_seat_create(name, notify, data) \
+	yt_seat_create_sized(name, notify, \
+			sizeof(struct yt_seat_notify_interface), data)
+int yt_seat_dispatch(struct yt_seat *seat, int budget);
+int yt_seat_thread_start(struct yt_seat *seat, const struct yt_seat_thread_config *config);
+void yt_seat_thread_stop(struct yt_seat *seat);
+int yt_seat_key_repeat_set(struct yt_seat *seat, int32_t rate, int32_t delay);
+int yt_seat_keymap_set(struct yt_seat *seat, const char *rules, const char *model,
+		const char *layout, const char *variant, const char *options);
+char *yt_seat_keymap_get_string(struct yt_seat *seat);
+void yt_seat_modifiers_get(struct yt_seat *seat, struct yt_modifiers *modifiers);
 void yt_device_led_state_set(struct yt_seat *seat, enum yt_led_state state);
 enum yt_led_state yt_device_led_state_get(struct yt_seat *seat);
 void yt_device_hotplug_handle();
 void yt_device_user_data_set(struct yt_device *device, void *user_data);
 void *yt_device_user_data_get(struct yt_device *device);
+uint64_t yt_device_time_ns_get(struct yt_device *device);
+uint32_t yt_device_keysym_get(struct yt_device *device);
+void yt_device_latency_get(struct yt_device *device, struct yt_latency *latency);
+void yt_device_latency_reset(struct yt_device *device);
+void yt_device_stats_get(struct yt_device *device, struct yt_device_stats *stats);
+int yt_device_accel_set(struct yt_device *device,
+		enum yt_accel_profile profile, double speed);
+int yt_device_touchpad_motion_set(struct yt_device *device,
+		unsigned int history_length, unsigned int smoothing);
+uint64_t yt_latency_bucket_ns(unsigned int bucket);
+int yt_device_record_start(struct yt_device *device, const char *path);
+void yt_device_record_stop(struct yt_device *device);
+int yt_device_event_mask_set(struct yt_device *device, unsigned int type,
+		unsigned int code, int enable);
+
+struct yt_device *yt_fake_device_create(const struct yt_fake_desc *desc);
+int yt_fake_device_write(struct yt_device *device,
+		const struct input_event *ev, int count);
+void yt_fake_device_destroy(struct yt_device *device);
+
+struct yt_replay *yt_replay_open(const char *path, struct yt_seat *seat);
+int yt_replay_run(struct yt_replay *replay, enum yt_replay_mode mode);
+struct yt_device *yt_replay_device_get(struct yt_replay *replay);
+void yt_replay_close(struct yt_replay *replay);
 
 typedef void (*yt_tty_vt_func_t)(void *data, int event);
 int yt_tty_create(struct yt_seat *seat, int tty_fd, int tty_nr, yt_tty_vt_func_t vt_func, void *data);